@@ -0,0 +1,74 @@
+'use strict'
+
+/**
+ * wire size and throughput of integer arrays with numberEncoding
+ * 'integer' and 'double'.
+ * flora-dispatcher must be listening on uri, see script/test
+ *
+ * node bench/flora-number-encoding.js [count] [arrayLength]
+ */
+
+var flora = require('..')
+var uri = 'unix:/var/run/flora.sock'
+var count = parseInt(process.argv[2]) || 50000
+var arrayLength = parseInt(process.argv[3]) || 16
+var sizeSamples = 100
+
+var payload = []
+for (var i = 0; i < arrayLength; ++i) {
+  // counters and enum codes
+  payload.push(i % 2 ? i * 1000 : i)
+}
+
+function run (encoding, done) {
+  var msgName = 'bench number encoding ' + encoding + ' ' + process.pid
+  // maxPendingBytes makes getQueueStats count serialized bytes
+  var recvClient = new flora.Agent(uri, { bufsize: 0, maxPendingBytes: 0x7fffffff })
+  var postClient = new flora.Agent(uri, { bufsize: 0, numberEncoding: encoding })
+  var received = 0
+  var bytesPerMsg
+  var startTime
+
+  recvClient.subscribe(msgName, () => {
+    ++received
+    if (received === sizeSamples) {
+      startTime = process.hrtime()
+      postBatch(0)
+    } else if (received === sizeSamples + count) {
+      var elapsed = process.hrtime(startTime)
+      var secs = elapsed[0] + elapsed[1] / 1e9
+      console.log(encoding, 'bytes/msg', bytesPerMsg,
+        'rate', Math.round(count / secs) + ' msgs/sec')
+      recvClient.close()
+      postClient.close()
+      done()
+    }
+  })
+  recvClient.start()
+  postClient.start()
+
+  function postBatch (sent) {
+    var end = Math.min(sent + 200, count)
+    for (var i = sent; i < end; ++i) {
+      postClient.post(msgName, payload)
+    }
+    if (end < count) {
+      setImmediate(postBatch, end)
+    }
+  }
+
+  setTimeout(() => {
+    for (var i = 0; i < sizeSamples; ++i) {
+      postClient.post(msgName, payload)
+    }
+    // hold js thread, let samples queue up for measurement
+    var end = Date.now() + 500
+    while (Date.now() < end) {}
+    var stats = recvClient.getQueueStats()
+    bytesPerMsg = Math.round(stats.pendingBytes / stats.pending)
+  }, 500)
+}
+
+run('double', () => {
+  run('integer', () => {})
+})
@@ -0,0 +1,59 @@
+'use strict'
+
+/**
+ * time spent on posting msgs with post in loop and with postBatch.
+ * flora-dispatcher must be listening on uri, see script/test
+ *
+ * node bench/flora-post-batch.js [count] [batch]
+ */
+
+var flora = require('..')
+var uri = 'unix:/var/run/flora.sock'
+var agentOptions = { reconnInterval: 10000, bufsize: 0 }
+var count = parseInt(process.argv[2]) || 100000
+var batch = parseInt(process.argv[3]) || 100
+var msgName = 'bench post batch ' + process.pid
+var payload = [ 1, 2, 'hello flora', [ 'foo' ] ]
+
+var postClient = new flora.Agent(uri, agentOptions)
+postClient.start()
+
+function report (title, startTime) {
+  var elapsed = process.hrtime(startTime)
+  var secs = elapsed[0] + elapsed[1] / 1e9
+  console.log(title, 'msgs', count, 'batch', batch, 'elapsed', secs.toFixed(3) + 's',
+    'rate', Math.round(count / secs) + ' msgs/sec')
+}
+
+function benchLoop () {
+  var startTime = process.hrtime()
+  for (var sent = 0; sent < count; sent += batch) {
+    var end = Math.min(sent + batch, count)
+    for (var i = sent; i < end; ++i) {
+      postClient.post(msgName, payload)
+    }
+  }
+  report('post', startTime)
+}
+
+function benchBatch () {
+  var msgs = []
+  for (var i = 0; i < batch; ++i) {
+    msgs.push([ msgName, payload ])
+  }
+  var startTime = process.hrtime()
+  for (var sent = 0; sent < count; sent += batch) {
+    if (count - sent < batch) {
+      msgs.length = count - sent
+    }
+    postClient.postBatch(msgs)
+  }
+  report('postBatch', startTime)
+}
+
+// wait for connection
+setTimeout(() => {
+  benchLoop()
+  benchBatch()
+  postClient.close()
+}, 500)
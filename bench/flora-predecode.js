@@ -0,0 +1,62 @@
+'use strict'
+
+/**
+ * throughput of string heavy nested msgs decoded on js thread and
+ * on flora thread (agent option predecode).
+ * flora-dispatcher must be listening on uri, see script/test
+ *
+ * node bench/flora-predecode.js [count] [arrayLength]
+ */
+
+var flora = require('..')
+var uri = 'unix:/var/run/flora.sock'
+var count = parseInt(process.argv[2]) || 50000
+var arrayLength = parseInt(process.argv[3]) || 16
+
+var payload = []
+for (var i = 0; i < arrayLength; ++i) {
+  payload.push([ 'rokid.turen.voice_coming', i, [ 'asr result ' + i, i * 0.5 ] ])
+}
+
+function run (predecode, done) {
+  var msgName = 'bench predecode ' + predecode + ' ' + process.pid
+  var recvClient = new flora.Agent(uri, { bufsize: 0, predecode: predecode })
+  var postClient = new flora.Agent(uri, { bufsize: 0 })
+  var received = 0
+  var startTime
+
+  recvClient.subscribe(msgName, (msg) => {
+    if (received === 0) {
+      startTime = process.hrtime()
+    }
+    ++received
+    if (received === count) {
+      var elapsed = process.hrtime(startTime)
+      var secs = elapsed[0] + elapsed[1] / 1e9
+      console.log('predecode', predecode, 'rate', Math.round(count / secs) + ' msgs/sec')
+      recvClient.close()
+      postClient.close()
+      done()
+    }
+  })
+  recvClient.start()
+  postClient.start()
+
+  function postBatch (sent) {
+    var end = Math.min(sent + 200, count)
+    for (var i = sent; i < end; ++i) {
+      postClient.post(msgName, payload)
+    }
+    if (end < count) {
+      setImmediate(postBatch, end)
+    }
+  }
+
+  setTimeout(() => {
+    postBatch(0)
+  }, 500)
+}
+
+run(false, () => {
+  run(true, () => {})
+})
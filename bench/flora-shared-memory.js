@@ -0,0 +1,66 @@
+'use strict'
+
+/**
+ * MB/s of large binary msgs, copied through socket or passed by memfd.
+ * flora-dispatcher must be listening on uri, see script/test
+ *
+ * node bench/flora-shared-memory.js [count] [size]
+ */
+
+var flora = require('..')
+var uri = 'unix:/var/run/flora.sock'
+var count = parseInt(process.argv[2]) || 200
+var size = parseInt(process.argv[3]) || 4 * 1024 * 1024
+var frame = Buffer.alloc(size, 0x5a)
+
+function run (sharedMemory, done) {
+  var msgName = 'bench shared memory ' + process.pid + ' ' + sharedMemory
+  // bufsize must hold a whole frame when copied through socket
+  var agentOptions = { reconnInterval: 10000, bufsize: size + 4096, sharedMemory: sharedMemory }
+  var recvClient = new flora.Agent(uri, agentOptions)
+  var postClient = new flora.Agent(uri, agentOptions)
+  var received = 0
+  var warmedUp = false
+  var startTime
+
+  recvClient.subscribe(msgName, (msg, type) => {
+    // touch the data as a consumer would
+    if (msg[0][size - 1] !== 0x5a) {
+      throw new Error('bad frame')
+    }
+    // first frame copied, memfds posted once receiver acked it
+    if (!warmedUp) {
+      warmedUp = true
+      setTimeout(() => {
+        startTime = process.hrtime()
+        post(0)
+      }, 100)
+      return
+    }
+    if (++received === count) {
+      var elapsed = process.hrtime(startTime)
+      var secs = elapsed[0] + elapsed[1] / 1e9
+      console.log(sharedMemory ? 'memfd ' : 'socket', 'frames', count, 'size', size,
+        'elapsed', secs.toFixed(3) + 's', 'rate', (count * size / secs / 1048576).toFixed(1) + ' MB/s')
+      recvClient.close()
+      postClient.close()
+      done()
+    }
+  })
+  recvClient.start()
+  postClient.start()
+
+  function post (sent) {
+    postClient.post(msgName, [ frame ])
+    if (sent + 1 < count) {
+      setImmediate(post, sent + 1)
+    }
+  }
+
+  // wait for subscription to reach dispatcher
+  setTimeout(() => {
+    postClient.post(msgName, [ frame ])
+  }, 500)
+}
+
+run(false, () => run(true, () => {}))
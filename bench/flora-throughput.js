@@ -0,0 +1,51 @@
+'use strict'
+
+/**
+ * end-to-end msgs/sec of one sender agent and one receiver agent.
+ * flora-dispatcher must be listening on uri, see script/test
+ *
+ * node bench/flora-throughput.js [count] [batch]
+ */
+
+var flora = require('..')
+var uri = 'unix:/var/run/flora.sock'
+var agentOptions = { reconnInterval: 10000, bufsize: 0 }
+var count = parseInt(process.argv[2]) || 100000
+var batch = parseInt(process.argv[3]) || 200
+var msgName = 'bench throughput ' + process.pid
+var payload = [ 1, 2, 'hello flora', [ 'foo' ] ]
+
+var recvClient = new flora.Agent(uri, agentOptions)
+var postClient = new flora.Agent(uri, agentOptions)
+var received = 0
+var startTime
+
+recvClient.subscribe(msgName, (msg, type) => {
+  ++received
+  if (received === count) {
+    var elapsed = process.hrtime(startTime)
+    var secs = elapsed[0] + elapsed[1] / 1e9
+    console.log('msgs', count, 'batch', batch, 'elapsed', secs.toFixed(3) + 's',
+      'rate', Math.round(count / secs) + ' msgs/sec')
+    recvClient.close()
+    postClient.close()
+  }
+})
+recvClient.start()
+postClient.start()
+
+function postBatch (sent) {
+  var end = Math.min(sent + batch, count)
+  for (var i = sent; i < end; ++i) {
+    postClient.post(msgName, payload)
+  }
+  if (end < count) {
+    setImmediate(postBatch, end)
+  }
+}
+
+// wait for subscription to reach dispatcher
+setTimeout(() => {
+  startTime = process.hrtime()
+  postBatch(0)
+}, 500)
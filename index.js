@@ -49,9 +49,37 @@
  * @param {string} uri - uri of flora service
  * @param {object} options
  * @param {number} options.reconnInterval - reconnect interval time when flora disconnected. default value 10000
- * @param {number} options.bufsize - flora msg buf size. default value 32768
+ * @param {number} options.bufsize - flora msg buf size. default value 32768, 0 for flora default size.
+ *                                    msgs and remote method params/replies must fit in it, unless option fragment set
+ * @param {boolean} options.fragment - post instant msgs larger than bufsize as fragments. fragments only reassembled by
+ *                                     agents of this module, c++ services and flora-cli receive them undecoded. default value false
  * @param {number} options.beepInterval - interval time of client send ping, only effective when connection is tcp protocol.
  * @param {number} options.norespTimeout - timeout of flora service no response, only effective when connection is tcp protocol.
+ * @param {number} options.maxPendingMsgs - max count of received msgs waiting for dispatch to handlers. default value 0, unlimited
+ * @param {number} options.maxPendingBytes - max bytes of received msgs waiting for dispatch to handlers, counted from sizes of msg members. default value 0, unlimited
+ * @param {string} options.overflowPolicy - what to do when pending msgs exceed limits. 'drop-oldest' | 'drop-newest' | 'block'. default value 'drop-oldest', which evicts msgs of lowest priority first. 'block' blocks the flora reader thread until handlers catch up. remote method invocations and chunks of Agent.callStream are never dropped
+ * @param {number} options.dispatchBudgetMsgs - max count of msgs dispatched to handlers in one event loop tick, remaining msgs dispatched in later ticks. default value 0, unlimited
+ * @param {number} options.dispatchBudgetUs - max microseconds spent on dispatching msgs to handlers in one event loop tick. default value 0, unlimited
+ * @param {string} options.numberEncoding - 'integer' | 'double'. 'integer' writes integral numbers as caps integer/long, 'double' writes every number as double like previous versions. default value 'integer'
+ * @param {boolean} options.sharedMemory - binary members not smaller than 64KB of instant msgs posted by memfd, received as
+ *                                          Buffer mapped on it without copies. only for 'unix:' uri. receivers setting it
+ *                                          ack msgs of a name to sender, sender posts memfds to the name only after acked,
+ *                                          so other receivers of the name must set it too. receiver must be permitted to
+ *                                          open /proc/<pid>/fd of sender. sender keeps memfd opened until receivers acked,
+ *                                          at most 10 seconds, msg dropped by receiver if memfd closed. default value false
+ * @param {boolean} options.predecode - decode received msgs and method params on flora thread into a flat buffer, js thread
+ *                                       only creates values of format 'array' from it. msgs with binary members still decoded
+ *                                       on js thread. default value false
+ * @param {boolean} options.shareConnection - agents created with same dispatcher uri and shareConnection in one process share one flora connection,
+ *                                             whatever '#id' each of them has. flora knows the connection by id of agent created it first,
+ *                                             msgs posted by any of them carry that id, and only agents of that id could declare methods,
+ *                                             declareMethod of other ids throws. later agents giving options different from the first
+ *                                             agent throw, options they omit are inherited. a name subscribed on the connection
+ *                                             already gets last persist msg seen by this process, as Agent.peek returns it.
+ *                                             agents of worker_threads share it too, msgs and method calls routed natively to
+ *                                             thread of agent subscribed or declared, queue options still apply to each thread.
+ *                                             overflowPolicy 'block' of one thread blocks delivery to all threads of the
+ *                                             connection. default value false
  */
 
 /**
@@ -67,24 +95,47 @@
  */
 
 /**
- * unsubscribe flora msg
- * @method unsubscribe
+ * get socket fd
+ * @method getSocket
  * @memberof module:@yoda/flora~Agent
- * @param {string} name - msg name for unsubscribe
+ * @returns {number|undefined} socket fd or undefined
  */
 
 /**
- * remove remote method
- * @method removeMethod
+ * get statistics of received msgs waiting for dispatch
+ * @method getQueueStats
  * @memberof module:@yoda/flora~Agent
- * @param {string} name - method name
+ * @returns {module:@yoda/flora~QueueStats|undefined} stats or undefined if agent closed
  */
 
 /**
- * get socket fd
- * @method getSocket
+ * get remote calls waiting for response. calls still pending when agent closed are rejected with ERROR_NOT_CONNECTED
+ * @method pendingCalls
  * @memberof module:@yoda/flora~Agent
- * @returns {number|undefined} socket fd or undefined
+ * @returns {module:@yoda/flora~PendingCalls|undefined} pending calls or undefined if agent closed
+ */
+
+/**
+ * @typedef {object} module:@yoda/flora~PendingCalls
+ * @property {number} count - count of pending calls, one callMany counted once
+ * @property {number} overdue - count of calls pending longer than their timeout
+ * @property {number} oldestAge - milliseconds since oldest pending call issued
+ * @property {object[]} calls - name, target (targets count for callMany), age and timeout of each pending call
+ */
+
+/**
+ * @typedef {object} module:@yoda/flora~QueueStats
+ * @property {number} pending - count of pending msgs
+ * @property {number} pendingBytes - bytes of pending msgs, only counted when options.maxPendingBytes set
+ * @property {number} dropped - count of msgs dropped by overflow policy
+ * @property {number} highWaterMark - max count of pending msgs ever reached
+ * @property {number} highWaterBytes - max bytes of pending msgs ever reached
+ * @property {number} slotHits - count of msgs queued in preallocated slots
+ * @property {number} slotMisses - count of msgs queued in allocated nodes, slots were all in use
+ * @property {number} capsPoolHits - count of native msg wrappers reused, counted for all agents of the thread
+ * @property {number} capsPoolMisses - count of native msg wrappers allocated, counted for all agents of the thread
+ * @property {number} replyPoolHits - count of native reply wrappers reused, counted for all agents of the thread
+ * @property {number} replyPoolMisses - count of native reply wrappers allocated, counted for all agents of the thread
  */
 
 /**
@@ -113,6 +164,13 @@
  * @param {number} - type of msg
  */
 
+/**
+ * @typedef {object} module:@yoda/flora~MsgFilter
+ * @property {number|number[]} index - index of msg member, array for member of nested array. e.g. [ 2, 0 ] is msg[2][0]
+ * @property {string} [type] - type of member: 'number' | 'string' | 'object' | 'binary' | 'undefined'
+ * @property {number|string|null|Array} [equals] - member must equal to the value or one of values in array
+ */
+
 /**
  * @callback module:@yoda/flora~DeclareMethodHandler
  * @param {any[]} - msg content
@@ -146,13 +204,20 @@
  * @param {any[]} [data] - return data
  */
 
-var Agent = require('./flora-cli.node').Agent
+var native = require('./flora-cli.node')
+var Agent = native.Agent
 var Caps
 try {
   Caps = require('@yoda/caps/caps.node').Caps
 } catch (e) {
   Caps = undefined
 }
+var crypto
+try {
+  crypto = require('crypto')
+} catch (e) {
+  crypto = undefined
+}
 
 function genCaps (hackedCaps) {
   if (typeof Caps !== 'function') {
@@ -165,6 +230,172 @@ function isCapsFormat (opts) {
   return typeof opts === 'object' && opts.format === 'caps'
 }
 
+function isLazyFormat (opts) {
+  return typeof opts === 'object' && opts.format === 'lazy'
+}
+
+var kLazyCaps = typeof Symbol === 'function' ? Symbol('lazyCaps') : '__lazyCaps'
+var kLazyLength = typeof Symbol === 'function' ? Symbol('lazyLength') : '__lazyLength'
+
+function isIndex (prop) {
+  if (typeof prop !== 'string') {
+    return -1
+  }
+  var idx = +prop
+  if (idx >= 0 && (idx | 0) === idx) {
+    return idx
+  }
+  return -1
+}
+
+function lazyLength (target) {
+  var len = target[kLazyLength]
+  if (len === undefined) {
+    len = native.lazyLength(target[kLazyCaps])
+    Object.defineProperty(target, kLazyLength, { value: len, configurable: true })
+  }
+  return len
+}
+
+// decoded members cached as own properties of target
+function lazyMember (target, idx) {
+  if (!Object.prototype.hasOwnProperty.call(target, idx)) {
+    if (idx >= lazyLength(target)) {
+      return undefined
+    }
+    target[idx] = native.lazyGet(target[kLazyCaps], idx, genLazy)
+  }
+  return target[idx]
+}
+
+function materialize (target) {
+  var len = lazyLength(target)
+  for (var i = 0; i < len; ++i) {
+    lazyMember(target, i)
+  }
+}
+
+var lazyHandler = {
+  get: function (target, prop) {
+    if (prop === 'length') {
+      return lazyLength(target)
+    }
+    var idx = isIndex(prop)
+    if (idx >= 0) {
+      return lazyMember(target, idx)
+    }
+    return target[prop]
+  },
+  has: function (target, prop) {
+    var idx = isIndex(prop)
+    if (idx >= 0) {
+      return idx < lazyLength(target)
+    }
+    return prop in target
+  },
+  ownKeys: function (target) {
+    materialize(target)
+    return Reflect.ownKeys(target).filter((key) => {
+      return typeof key !== 'symbol'
+    })
+  },
+  getOwnPropertyDescriptor: function (target, prop) {
+    var idx = isIndex(prop)
+    if (idx >= 0) {
+      lazyMember(target, idx)
+    } else if (prop === 'length') {
+      materialize(target)
+    }
+    return Reflect.getOwnPropertyDescriptor(target, prop)
+  },
+  set: function () {
+    return false
+  }
+}
+
+/**
+ * read only array like view of msg. members read natively up to the index accessed, strings not copied,
+ * js values created on first access. length reads all members without creating values.
+ * fallback to array if Proxy not supported
+ */
+function genLazy (hackedCaps) {
+  if (typeof Proxy !== 'function') {
+    var arr = []
+    var len = native.lazyLength(hackedCaps)
+    for (var i = 0; i < len; ++i) {
+      arr.push(native.lazyGet(hackedCaps, i, genLazy))
+    }
+    return arr
+  }
+  var target = []
+  Object.defineProperty(target, kLazyCaps, { value: hackedCaps, configurable: true })
+  return new Proxy(target, lazyHandler)
+}
+
+function genMsg (agent, hackedCaps, options) {
+  if (isCapsFormat(options)) {
+    return genCaps(hackedCaps)
+  }
+  if (isLazyFormat(options)) {
+    return genLazy(hackedCaps)
+  }
+  return agent.nativeGenArray(hackedCaps)
+}
+
+// msg decoded once for handlers of same msg name with same format
+// subscribed with shareMsg. Caps objects have read position, never shared
+var sharedMsg = { caps: null, values: {} }
+
+function isSharedMsg (opts) {
+  return typeof opts === 'object' && opts !== null && opts.shareMsg === true &&
+    opts.format !== 'caps'
+}
+
+function genSharedMsg (agent, hackedCaps, options, remaining) {
+  var cbmsg
+  if (!isSharedMsg(options)) {
+    cbmsg = genMsg(agent, hackedCaps, options)
+  } else {
+    var format = isLazyFormat(options) ? 'lazy' : 'array'
+    if (sharedMsg.caps === hackedCaps && sharedMsg.values.hasOwnProperty(format)) {
+      cbmsg = sharedMsg.values[format]
+    } else {
+      cbmsg = genMsg(agent, hackedCaps, options)
+      if (remaining > 0) {
+        if (sharedMsg.caps !== hackedCaps) {
+          sharedMsg.caps = hackedCaps
+          sharedMsg.values = {}
+        }
+        sharedMsg.values[format] = cbmsg
+      }
+    }
+  }
+  if (remaining === 0 && sharedMsg.caps !== null) {
+    sharedMsg.caps = null
+    sharedMsg.values = {}
+  }
+  return cbmsg
+}
+
+/**
+ * handle of a msg handler, returned by Agent.subscribe
+ * @class module:@yoda/flora~Subscription
+ */
+function Subscription (agent, name, id) {
+  this.agent = agent
+  this.name = name
+  this.id = id
+}
+
+/**
+ * remove this handler, other handlers of the msg name not affected
+ * @method unsubscribe
+ * @memberof module:@yoda/flora~Subscription
+ */
+Subscription.prototype.unsubscribe = function () {
+  this.agent.unsubscribe(this.name, this)
+}
+
 /**
  * subscribe flora msg
  * @method subscribe
@@ -172,16 +403,41 @@ function isCapsFormat (opts) {
  * @param {string} name - msg name for subscribe
  * @param {module:@yoda/flora~SubscribeMsgHandler} handler - msg handler of received msg
  * @param {object} options
- * @param {string} options.format - specify format of received message. format string values: 'array' | 'caps'
+ * @param {string} options.format - specify format of received message. format string values: 'array' | 'caps' | 'lazy'.
+ *                                  'lazy' gives a read only array like view, members decoded up to the index accessed
+ * @param {module:@yoda/flora~MsgFilter|module:@yoda/flora~MsgFilter[]} options.filter - only msgs match all filters
+ *                                  delivered to handler, others dropped natively before queued for js thread
+ * @param {number} options.maxRate - max msgs per second delivered to handler, excess msgs dropped natively.
+ *                                   newest msg dropped in an interval delivered when the interval ends
+ * @param {string} options.coalesce - 'latest': handler only gets newest of msgs queued while js thread busy
+ * @param {string} options.priority - 'high' | 'normal' | 'low', default 'normal'. msgs of names with handlers of
+ *                                  higher priority are dispatched first. msgs of one name keep their order, queued
+ *                                  by highest priority of all handlers of the name
+ * @param {boolean} options.sender - false if handler ignores sender argument, sender info not built for msgs
+ *                                  if no handler of msg name wants it. default value true
+ * @param {boolean} options.shareMsg - handlers of same msg name and format subscribed with shareMsg get one
+ *                                  decoded msg, handler must not modify it. default value false, each handler
+ *                                  gets its own copy
+ * @returns {module:@yoda/flora~Subscription|undefined} handle for removing this handler.
+ *                                  handlers of same msg name share one flora subscription
  */
 Agent.prototype.subscribe = function (name, handler, options) {
-  this.nativeSubscribe(name, (msg, type, sender) => {
-    var cbmsg
-    if (isCapsFormat(options)) {
-      cbmsg = genCaps(msg)
-    } else {
-      cbmsg = this.nativeGenArray(msg)
+  var filter
+  var handlerOptions
+  if (typeof options === 'object') {
+    filter = options.filter
+    if (options.maxRate !== undefined || options.coalesce !== undefined ||
+      options.priority !== undefined || options.sender !== undefined) {
+      handlerOptions = {
+        maxRate: options.maxRate,
+        coalesce: options.coalesce,
+        priority: options.priority,
+        sender: options.sender
+      }
     }
+  }
+  var id = this.nativeSubscribe(name, (msg, type, sender, remaining) => {
+    var cbmsg = genSharedMsg(this, msg, options, remaining)
     try {
       handler(cbmsg, type, sender)
     } catch (e) {
@@ -189,7 +445,25 @@ Agent.prototype.subscribe = function (name, handler, options) {
         throw e
       })
     }
-  })
+  }, filter, handlerOptions)
+  if (id === undefined) {
+    return undefined
+  }
+  return new Subscription(this, name, id)
+}
+
+/**
+ * unsubscribe flora msg
+ * @method unsubscribe
+ * @memberof module:@yoda/flora~Agent
+ * @param {string} name - msg name for unsubscribe
+ * @param {module:@yoda/flora~Subscription} [subscription] - only remove this handler. all handlers of name removed if not specified
+ */
+Agent.prototype.unsubscribe = function (name, subscription) {
+  if (subscription instanceof Subscription) {
+    return this.nativeUnsubscribe(name, subscription.id)
+  }
+  return this.nativeUnsubscribe(name)
 }
 /**
  * declare remote method
@@ -198,15 +472,30 @@ Agent.prototype.subscribe = function (name, handler, options) {
  * @param {string} name - method name
  * @param {module:@yoda/flora~DeclareMethodHandler} handler - handler of remote method call
  * @param {object} options
- * @param {string} options.format - specify format of received method params. format string values: 'array' | 'caps'
+ * @param {string} options.format - specify format of received method params. format string values: 'array' | 'caps' | 'lazy'
+ * @param {string} options.priority - 'high' | 'normal' | 'low', default 'normal'. invocations of higher priority
+ *                                    methods are dispatched first
+ * @param {boolean} options.sender - false if handler ignores sender argument, sender info not built for
+ *                                   invocations. default value true
+ * @param {boolean} options.stream - true if method called by Agent.callStream, reply of handler is a
+ *                                   module:@yoda/flora~StreamReply. not callable by Agent.call
  */
 Agent.prototype.declareMethod = function (name, handler, options) {
-  this.nativeDeclareMethod(name, (msg, reply, sender) => {
-    var cbmsg
-    if (isCapsFormat(options)) {
-      cbmsg = genCaps(msg)
-    } else {
-      cbmsg = this.nativeGenArray(msg)
+  var priority
+  var sender
+  var stream = false
+  if (typeof options === 'object' && options !== null) {
+    priority = options.priority
+    sender = options.sender
+    stream = options.stream === true
+  }
+  if (stream) {
+    name = kStreamMethodPrefix + name
+  }
+  this.nativeDeclareMethod(name, (msg, reply, sender, streamName) => {
+    var cbmsg = genMsg(this, msg, options)
+    if (stream) {
+      reply = new StreamReply(this, reply, streamName)
     }
     try {
       return handler(cbmsg, reply, sender)
@@ -215,7 +504,250 @@ Agent.prototype.declareMethod = function (name, handler, options) {
         throw e
       })
     }
+  }, { priority: priority, sender: sender, stream: stream })
+}
+
+/**
+ * remove remote method
+ * @method removeMethod
+ * @memberof module:@yoda/flora~Agent
+ * @param {string} name - method name
+ */
+Agent.prototype.removeMethod = function (name) {
+  this.nativeRemoveMethod(name)
+  if (typeof name === 'string') {
+    this.nativeRemoveMethod(kStreamMethodPrefix + name)
+  }
+}
+
+// methods declared with option stream, apart from methods of Agent.call
+var kStreamMethodPrefix = '\u0001flora-stream/'
+var kStreamPrefix = 'flora-stream/'
+var kDefaultChunkTimeout = 5000
+
+// chunk msg name of one call, not guessable from names of other calls
+function randomStreamName () {
+  if (crypto && typeof crypto.randomBytes === 'function') {
+    return kStreamPrefix + crypto.randomBytes(16).toString('hex')
+  }
+  var name = kStreamPrefix
+  for (var i = 0; i < 4; ++i) {
+    name += ('0000000' + Math.floor(Math.random() * 0x100000000).toString(16)).slice(-8)
+  }
+  return name
+}
+
+/**
+ * Reply of method invoked by Agent.callStream, each data written sent to caller immediately
+ * @class module:@yoda/flora~StreamReply
+ */
+function StreamReply (agent, reply, stream) {
+  this.agent = agent
+  this.reply = reply
+  this.stream = stream
+  this.seq = 0
+  this.code = 0
+}
+
+StreamReply.prototype.writeCode = function (code) {
+  this.code = code
+}
+
+/**
+ * send data to caller immediately
+ * @method writeData
+ * @memberof module:@yoda/flora~StreamReply
+ * @param {any[]|module:@yoda/caps~Caps} data - chunk data, Caps received as array by caller
+ */
+StreamReply.prototype.writeData = function (data) {
+  if (!isValidMsg(data)) {
+    throw codeToError(exports.ERROR_INVALID_PARAM)
+  }
+  var r = this.agent.nativePostChunk(this.stream, this.seq, data, isCaps(data))
+  if (r !== 0) {
+    throw codeToError(r)
+  }
+  ++this.seq
+}
+
+StreamReply.prototype.end = function (code, data) {
+  if (code !== undefined) {
+    this.writeCode(code)
+  }
+  if (data !== undefined) {
+    this.writeData(data)
+  }
+  // caller finishes stream when all chunks received
+  this.reply.end(this.code, [ this.seq ])
+}
+
+/**
+ * chunks of Agent.callStream, an async iterator
+ * @class module:@yoda/flora~CallStream
+ */
+function CallStream (chunkTimeout) {
+  // chunks received but not consumed, in order
+  this.chunks = []
+  this.received = 0
+  // count of chunks, known when reply received
+  this.total = -1
+  this.error = null
+  this.waiters = []
+  this.chunkTimeout = chunkTimeout
+  this.timer = null
+  /**
+   * return code of remote method, set when all chunks received
+   * @memberof module:@yoda/flora~CallStream
+   * @member {number} retCode
+   */
+  this.retCode = undefined
+}
+
+/**
+ * get next chunk
+ * @method next
+ * @memberof module:@yoda/flora~CallStream
+ * @returns {Promise} promise that resolves with { value: any[], done: boolean }
+ */
+CallStream.prototype.next = function () {
+  return new Promise((resolve, reject) => {
+    this.waiters.push({ resolve: resolve, reject: reject })
+    this.flush()
+  })
+}
+
+// chunks of one stream dispatched in order, a missing sequence means the
+// chunk was dropped on the way
+CallStream.prototype.push = function (seq, data) {
+  if (this.finished()) {
+    return
+  }
+  if (seq !== this.received) {
+    this.fail(codeToError(exports.ERROR_CHUNK_LOST))
+    return
+  }
+  ++this.received
+  this.chunks.push(data)
+  this.resetTimer()
+  this.flush()
+}
+
+CallStream.prototype.end = function (code, total) {
+  if (this.finished()) {
+    return
+  }
+  this.retCode = code
+  this.total = total
+  this.resetTimer()
+  this.flush()
+}
+
+CallStream.prototype.fail = function (err) {
+  if (this.error === null) {
+    this.error = err
+  }
+  this.flush()
+}
+
+// started when first chunk or reply received, before that call timeout applies
+CallStream.prototype.resetTimer = function () {
+  if (this.timer) {
+    clearTimeout(this.timer)
+  }
+  this.timer = setTimeout(() => {
+    this.timer = null
+    this.fail(codeToError(this.total >= 0 ? exports.ERROR_CHUNK_LOST : exports.ERROR_TIMEOUT))
+  }, this.chunkTimeout)
+}
+
+CallStream.prototype.finished = function () {
+  return this.error !== null || (this.total >= 0 && this.received >= this.total)
+}
+
+CallStream.prototype.flush = function () {
+  while (this.waiters.length > 0) {
+    if (this.chunks.length > 0) {
+      this.waiters.shift().resolve({ value: this.chunks.shift(), done: false })
+    } else if (this.error !== null) {
+      this.waiters.shift().reject(this.error)
+    } else if (this.finished()) {
+      this.waiters.shift().resolve({ value: undefined, done: true })
+    } else {
+      break
+    }
+  }
+  if (this.finished()) {
+    if (this.timer) {
+      clearTimeout(this.timer)
+      this.timer = null
+    }
+    if (this.onfinish) {
+      this.onfinish()
+      this.onfinish = null
+    }
+  }
+}
+
+if (typeof Symbol === 'function' && Symbol.asyncIterator) {
+  CallStream.prototype[Symbol.asyncIterator] = function () {
+    return this
+  }
+}
+
+/**
+ * remote method call, data written by callee received as chunks before method ends.
+ * callee declares the method with option stream, its reply is a module:@yoda/flora~StreamReply.
+ * chunks are flora msgs of a random name of this call, routed by dispatcher to the caller only as long as no
+ * other agent subscribes that name. flora has no access control, so do not stream secrets. chunks are never dropped
+ * by overflowPolicy of the caller. stream fails with ERROR_CHUNK_LOST if a chunk lost anyway, e.g. callee disconnected
+ * @method callStream
+ * @memberof module:@yoda/flora~Agent
+ * @param {string} name - msg name
+ * @param {any[]} [msg] - method params
+ * @param {string} target - target client id of remote method
+ * @param {number} [timeout] - remote call timeout, for method end
+ * @param {object} [options]
+ * @param {string} options.format - specify format of chunks. format string values: 'array' | 'lazy'
+ * @param {AbortSignal} options.signal - abort the call
+ * @param {number} options.chunkTimeout - max milliseconds waiting for next chunk once stream started,
+ *                                        stream fails with ERROR_TIMEOUT. default 5000
+ * @returns {module:@yoda/flora~CallStream} async iterator of chunks, for await (var chunk of stream)
+ */
+Agent.prototype.callStream = function (name, msg, target, timeout, options) {
+  var chunkTimeout = typeof options === 'object' && options !== null &&
+    typeof options.chunkTimeout === 'number' ? options.chunkTimeout : kDefaultChunkTimeout
+  var stream = new CallStream(chunkTimeout)
+  if (typeof name !== 'string' || !(msg === undefined || msg === null || Array.isArray(msg)) ||
+    typeof target !== 'string') {
+    stream.fail(codeToError(exports.ERROR_INVALID_PARAM))
+    return stream
+  }
+  var streamName = randomStreamName()
+  var chunkOptions = isLazyFormat(options) ? options : undefined
+  // subscribed before call, dispatcher handles them in order.
+  // chunks not dropped or counted by queue limits
+  var id = this.nativeSubscribe(streamName, (msg) => {
+    try {
+      var chunk = genMsg(this, msg, chunkOptions)
+      stream.push(chunk[0], chunk[1])
+    } catch (e) {
+      stream.fail(e)
+    }
+  }, undefined, { stream: true, sender: false })
+  stream.onfinish = () => {
+    if (id !== undefined) {
+      this.nativeUnsubscribe(streamName, id)
+    }
+  }
+  var signal = getSignal(options)
+  this.call(kStreamMethodPrefix + name, [ streamName, msg ], target, timeout,
+    signal ? { signal: signal } : undefined).then((reply) => {
+    var total = Array.isArray(reply.msg) ? reply.msg[0] : undefined
+    stream.end(reply.retCode, typeof total === 'number' ? total : 0)
+  }, (err) => {
+    stream.fail(err)
   })
+  return stream
 }
 
 function isCaps (msg) {
@@ -260,6 +792,12 @@ function codeToError (code) {
     case exports.ERROR_DUPLICATED_ID:
       err = new Error('flora client id duplicated')
       break
+    case exports.ERROR_CANCELED:
+      err = new Error('flora call canceled')
+      break
+    case exports.ERROR_CHUNK_LOST:
+      err = new Error('flora stream chunk lost')
+      break
     default:
       err = new Error('unknown error code ' + code)
       break
@@ -272,7 +810,9 @@ function codeToError (code) {
  * @method post
  * @memberof module:@yoda/flora~Agent
  * @param {string} name - msg name
- * @param {any[]|module:@yoda/caps~Caps} msg - msg content
+ * @param {any[]|module:@yoda/caps~Caps} msg - msg content. members could be number, string, null, undefined, array,
+ *                                               and on node.js Buffer, ArrayBuffer or TypedArray, received as Buffer.
+ *                                               received Buffers may share memory with the msg and other handlers, treat them as read only
  * @param {number} type - msg type:
  *                        module:@yoda/flora~MSGTYPE_INSTANT
  *                        module:@yoda/flora~MSGTYPE_PERSIST
@@ -287,6 +827,103 @@ Agent.prototype.post = function (name, msg, type) {
   return r
 }
 
+/**
+ * get last persist msg of name received or posted by agents of this process connected to same dispatcher,
+ * without asking dispatcher. msgs forgotten when all agents of the dispatcher closed
+ * @method peek
+ * @memberof module:@yoda/flora~Agent
+ * @param {string} name - msg name
+ * @param {object} [options]
+ * @param {string} options.format - specify format of msg. format string values: 'array' | 'caps' | 'lazy'
+ * @returns {any[]|module:@yoda/flora~Caps|undefined} msg, or undefined if no persist msg of name seen by this process
+ */
+Agent.prototype.peek = function (name, options) {
+  if (typeof name !== 'string') {
+    throw codeToError(exports.ERROR_INVALID_PARAM)
+  }
+  var msg = this.nativePeek(name)
+  if (msg === undefined) {
+    return undefined
+  }
+  return genMsg(this, msg, options)
+}
+
+/**
+ * post many msgs in one native call
+ * @method postBatch
+ * @memberof module:@yoda/flora~Agent
+ * @param {Array[]} msgs - array of [ name, msg, type ], arguments as in Agent.post
+ * @returns {number[]} result code of each msg, 0 for success. invalid items get ERROR_INVALID_PARAM, other msgs still posted
+ */
+Agent.prototype.postBatch = function (msgs) {
+  if (!Array.isArray(msgs)) {
+    throw codeToError(exports.ERROR_INVALID_PARAM)
+  }
+  // native only takes msg of item as Caps if flagged here
+  var capsFlags = msgs.map((item) => {
+    return Array.isArray(item) && isCaps(item[1])
+  })
+  var r = this.nativePostBatch(msgs, capsFlags)
+  if (typeof r === 'number') { throw codeToError(r) }
+  return r
+}
+
+/**
+ * msg converted once by Agent.prepare, for posting same msg many times
+ * @class module:@yoda/flora~PreparedMsg
+ */
+function PreparedMsg (agent, handle) {
+  this.agent = agent
+  this.handle = handle
+}
+
+/**
+ * replace one member of msg, e.g. a timestamp. other members not converted again
+ * @method set
+ * @memberof module:@yoda/flora~PreparedMsg
+ * @param {number} index - index of top level member, equal to count of members for appending
+ * @param {any} value - number, string, null, undefined, array, or binary as in Agent.post
+ */
+PreparedMsg.prototype.set = function (index, value) {
+  var r = this.agent.nativeSetPrepared(this.handle, index, value)
+  if (r !== 0) { throw codeToError(r) }
+}
+
+/**
+ * post the msg
+ * @method post
+ * @memberof module:@yoda/flora~PreparedMsg
+ * @param {number} type - msg type:
+ *                        module:@yoda/flora~MSGTYPE_INSTANT
+ *                        module:@yoda/flora~MSGTYPE_PERSIST
+ * @returns {number} 0 for success, otherwise error code
+ */
+PreparedMsg.prototype.post = function (type) {
+  if (!isValidPostType(type)) {
+    throw codeToError(exports.ERROR_INVALID_PARAM)
+  }
+  var r = this.agent.nativePostPrepared(this.handle, type)
+  if (r !== 0) { throw codeToError(r) }
+  return r
+}
+
+/**
+ * convert msg name and content once for posting many times
+ * @method prepare
+ * @memberof module:@yoda/flora~Agent
+ * @param {string} name - msg name
+ * @param {any[]|module:@yoda/caps~Caps} msg - msg content, as in Agent.post
+ * @returns {module:@yoda/flora~PreparedMsg}
+ */
+Agent.prototype.prepare = function (name, msg) {
+  if (typeof name !== 'string' || !isValidMsg(msg)) {
+    throw codeToError(exports.ERROR_INVALID_PARAM)
+  }
+  var handle = this.nativePrepare(name, msg, isCaps(msg))
+  if (typeof handle === 'number') { throw codeToError(handle) }
+  return new PreparedMsg(this, handle)
+}
+
 /**
  * remote method call
  * @method call
@@ -296,29 +933,125 @@ Agent.prototype.post = function (name, msg, type) {
  * @param {string} target - target client id of remote method
  * @param {number} [timeout] - remote call timeout
  * @param {object} [options]
- * @param {string} options.format - specify format of method params. format string values: 'array' | 'caps'
+ * @param {string} options.format - specify format of response msg. format string values: 'array' | 'caps' | 'lazy'
+ * @param {AbortSignal} options.signal - abort the call, promise rejected with ERROR_CANCELED and response ignored.
+ *                                       callee is not notified
+ * @param {string} options.priority - 'high' | 'normal' | 'low', default 'normal'. responses of higher priority
+ *                                    calls are dispatched first
  * @returns {Promise} promise that resolves with {number} rescode, {module:@yoda/flora~Response}
  */
 Agent.prototype.call = function (name, msg, target, timeout, options) {
   if (typeof name !== 'string' || !isValidMsg(msg) || typeof target !== 'string') {
     return Promise.reject(codeToError(exports.ERROR_INVALID_PARAM))
   }
+  var signal = getSignal(options)
+  if (signal && signal.aborted) {
+    return Promise.reject(codeToError(exports.ERROR_CANCELED))
+  }
   return new Promise((resolve, reject) => {
+    var onabort
     var r = this.nativeCall(name, msg, target, (rescode, reply) => {
+      if (onabort) {
+        signal.removeEventListener('abort', onabort)
+      }
       if (rescode === 0) {
-        if (isCapsFormat(options)) {
-          reply.msg = genCaps(reply.msg)
-        } else {
-          reply.msg = this.nativeGenArray(reply.msg)
-        }
+        reply.msg = genMsg(this, reply.msg, options)
         resolve(reply)
       } else {
         reject(codeToError(rescode))
       }
-    }, isCaps(msg), timeout)
-    if (r !== 0) {
+    }, isCaps(msg), timeout, options && options.priority)
+    if (r < 0) {
       reject(codeToError(r))
+      return
     }
+    onabort = listenAbort(this, signal, r, reject)
+  })
+}
+
+function getSignal (options) {
+  if (typeof options !== 'object' || options === null) {
+    return undefined
+  }
+  var signal = options.signal
+  if (typeof signal !== 'object' || signal === null ||
+    typeof signal.addEventListener !== 'function') {
+    return undefined
+  }
+  return signal
+}
+
+// returns the listener added to signal
+function listenAbort (agent, signal, callId, reject) {
+  if (!signal) {
+    return undefined
+  }
+  var onabort = () => {
+    signal.removeEventListener('abort', onabort)
+    if (agent.nativeCancelCall(callId)) {
+      reject(codeToError(exports.ERROR_CANCELED))
+    }
+  }
+  signal.addEventListener('abort', onabort)
+  return onabort
+}
+
+/**
+ * @typedef {object} module:@yoda/flora~CallResult
+ * @property {string} target - target client id
+ * @property {number} code - 0 for success, otherwise error code
+ * @property {module:@yoda/flora~Response} [response] - response of target if code is 0
+ * @property {Error} [error] - error of code if code is not 0
+ */
+
+/**
+ * call same remote method of many targets, msg serialized once
+ * @method callMany
+ * @memberof module:@yoda/flora~Agent
+ * @param {string} name - msg name
+ * @param {any[]|module:@yoda/caps~Caps} [msg] - method params
+ * @param {string[]} targets - target client ids of remote method
+ * @param {number} [timeout] - remote call timeout
+ * @param {object} [options]
+ * @param {string} options.format - specify format of response msg. format string values: 'array' | 'caps' | 'lazy'
+ * @param {AbortSignal} options.signal - abort calls of all targets, promise rejected with ERROR_CANCELED
+ * @param {string} options.priority - 'high' | 'normal' | 'low', default 'normal'. results of higher priority
+ *                                    calls are dispatched first
+ * @returns {Promise} promise that resolves with {module:@yoda/flora~CallResult[]} when all targets responded or failed,
+ *                    in order of targets
+ */
+Agent.prototype.callMany = function (name, msg, targets, timeout, options) {
+  if (typeof name !== 'string' || !isValidMsg(msg) || !Array.isArray(targets)) {
+    return Promise.reject(codeToError(exports.ERROR_INVALID_PARAM))
+  }
+  var signal = getSignal(options)
+  if (signal && signal.aborted) {
+    return Promise.reject(codeToError(exports.ERROR_CANCELED))
+  }
+  if (targets.length === 0) {
+    return Promise.resolve([])
+  }
+  return new Promise((resolve, reject) => {
+    var onabort
+    var r = this.nativeCallMany(name, msg, targets, (results) => {
+      if (onabort) {
+        signal.removeEventListener('abort', onabort)
+      }
+      results.forEach((res, idx) => {
+        res.target = targets[idx]
+        if (res.code === 0) {
+          res.response.msg = genMsg(this, res.response.msg, options)
+        } else {
+          res.error = codeToError(res.code)
+        }
+      })
+      resolve(results)
+    }, isCaps(msg), timeout, options && options.priority)
+    if (r < 0) {
+      reject(codeToError(r))
+      return
+    }
+    onabort = listenAbort(this, signal, r, reject)
   })
 }
 
@@ -365,3 +1098,13 @@ exports.ERROR_TARGET_NOT_EXISTS = -5
  * @member {number} ERROR_DUPLICATED_ID
  */
 exports.ERROR_DUPLICATED_ID = -6
+/**
+ * @memberof module:@yoda/flora
+ * @member {number} ERROR_CANCELED
+ */
+exports.ERROR_CANCELED = -7
+/**
+ * @memberof module:@yoda/flora
+ * @member {number} ERROR_CHUNK_LOST
+ */
+exports.ERROR_CHUNK_LOST = -8
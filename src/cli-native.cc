@@ -1,5 +1,8 @@
 #include <utility>
 #include <chrono>
+#include <cmath>
+#include <cstring>
+#include <unistd.h>
 #include "cli-native.h"
 
 #define ERROR_INVALID_URI -1
@@ -12,12 +15,98 @@ using namespace Napi;
 using namespace flora;
 
 static bool genCapsByJSArray(napi_env env, napi_value jsmsg,
-                             shared_ptr<Caps>& caps);
+                             shared_ptr<Caps>& caps, uint32_t flags);
 static bool genCapsByJSCaps(napi_env env, napi_value jsmsg,
                             shared_ptr<Caps>& caps);
-static Napi::Value genJSArrayByCaps(Napi::Env& env, std::shared_ptr<Caps>& msg);
+static Napi::Value genJSArrayByCaps(Napi::Env& env, std::shared_ptr<Caps>& msg,
+                                    std::shared_ptr<Caps>& storage,
+                                    const shared_ptr<ShmBinaries>& shm);
+static uint32_t capsBinarySize(std::shared_ptr<Caps>& caps);
+static napi_value genHackedCaps(napi_env env, shared_ptr<Caps> msg,
+                                shared_ptr<FlatMsg> flat = nullptr,
+                                shared_ptr<Caps> storage = nullptr,
+                                shared_ptr<ShmBinaries> shm = nullptr);
+static bool genCapsMemberByJS(napi_env env, napi_value v, CapsMember& m,
+                              uint32_t flags);
+static void writeCapsMember(shared_ptr<Caps>& caps, const CapsMember& m);
+static void readCapsMembers(shared_ptr<Caps>& msg,
+                            std::vector<CapsMember>& members);
+
+thread_local napi_ref NativeReply::replyConstructor;
+
+// finalizers run on js thread of env, pools per thread
+static thread_local ObjectPool<HackedNativeCaps> hackedCapsPool;
+static thread_local ObjectPool<NativeReply> replyPool;
+
+// agents created with shareConnection in one env share one ClientNative,
+// agents of other envs share its FloraConnection. by env and uri without
+// client id
+static std::mutex connectionPoolMutex;
+static std::map<std::pair<napi_env, std::string>, ClientNative*>
+    connectionPool;
+static std::atomic<uint32_t> lastOwnerId{ 0 };
+
+// last persist msg of each msg name received or posted in this process,
+// serialized, by msg name. dropped when last client of the uri closed
+class PersistMsgs {
+ public:
+  uint32_t clients = 0;
+  std::map<std::string, std::vector<uint8_t>> msgs;
+};
+static std::mutex persistMutex;
+// by dispatcher uri
+static std::map<std::string, PersistMsgs> persistMsgs;
+
+static void usePersistMsgs(const std::string& uri) {
+  std::lock_guard<std::mutex> locker(persistMutex);
+  ++persistMsgs[uri].clients;
+}
 
-napi_ref NativeReply::replyConstructor;
+static void unusePersistMsgs(const std::string& uri) {
+  std::lock_guard<std::mutex> locker(persistMutex);
+  auto it = persistMsgs.find(uri);
+  if (it != persistMsgs.end() && --it->second.clients == 0)
+    persistMsgs.erase(it);
+}
+
+// msg may be read by flora thread or be a Caps of js after this,
+// cache keeps a copy of bytes
+static void cachePersistMsg(const std::string& uri, const char* name,
+                            shared_ptr<Caps>& msg) {
+  std::vector<uint8_t> bytes;
+  if (msg.get()) {
+    int32_t size = msg->serialize(nullptr, 0);
+    if (size <= 0)
+      return;
+    bytes.resize(size);
+    if (msg->serialize(bytes.data(), size) != size)
+      return;
+  }
+  std::lock_guard<std::mutex> locker(persistMutex);
+  auto it = persistMsgs.find(uri);
+  if (it != persistMsgs.end())
+    it->second.msgs[name].swap(bytes);
+}
+
+// msg parsed from a copy of bytes, null if persist msg has no content
+static bool peekPersistMsg(const std::string& uri, const std::string& name,
+                           shared_ptr<Caps>& msg) {
+  std::vector<uint8_t> bytes;
+  {
+    std::lock_guard<std::mutex> locker(persistMutex);
+    auto it = persistMsgs.find(uri);
+    if (it == persistMsgs.end())
+      return false;
+    auto mit = it->second.msgs.find(name);
+    if (mit == it->second.msgs.end())
+      return false;
+    bytes = mit->second;
+  }
+  msg.reset();
+  if (bytes.empty())
+    return true;
+  return Caps::parse(bytes.data(), bytes.size(), msg, true) == CAPS_SUCCESS;
+}
 
 static void msg_async_cb(uv_async_t* handle) {
   ClientNative* _this = reinterpret_cast<ClientNative*>(handle->data);
@@ -29,11 +118,22 @@ static void resp_async_cb(uv_async_t* handle) {
   _this->handleRespCallbacks();
 }
 
+static void trailing_timer_cb(uv_timer_t* handle) {
+  ClientNative* _this = reinterpret_cast<ClientNative*>(handle->data);
+  _this->dispatchTrailing();
+}
+
 static void async_close_cb(uv_handle_t* handle) {
-  uv_async_t* ah = reinterpret_cast<uv_async_t*>(handle);
-  reinterpret_cast<ClientNative*>(ah->data)->refDown();
+  reinterpret_cast<ClientNative*>(handle->data)->refDown();
 }
 
+#if NAPI_VERSION >= 3
+// env of worker thread torn down, agents not closed by js
+static void env_cleanup_cb(void* arg) {
+  reinterpret_cast<ClientNative*>(arg)->envCleanup();
+}
+#endif
+
 Object NativeObjectWrap::Init(Napi::Env env, Object exports) {
   HandleScope scope(env);
 
@@ -42,69 +142,145 @@ Object NativeObjectWrap::Init(Napi::Env env, Object exports) {
                   { InstanceMethod("start", &NativeObjectWrap::start),
                     InstanceMethod("nativeSubscribe",
                                    &NativeObjectWrap::subscribe),
-                    InstanceMethod("unsubscribe",
+                    InstanceMethod("nativeUnsubscribe",
                                    &NativeObjectWrap::unsubscribe),
                     InstanceMethod("nativeDeclareMethod",
                                    &NativeObjectWrap::declareMethod),
-                    InstanceMethod("removeMethod",
+                    InstanceMethod("nativeRemoveMethod",
                                    &NativeObjectWrap::removeMethod),
                     InstanceMethod("close", &NativeObjectWrap::close),
                     InstanceMethod("getSocket", &NativeObjectWrap::getSocket),
                     InstanceMethod("nativeGenArray",
                                    &NativeObjectWrap::genArray),
                     InstanceMethod("nativePost", &NativeObjectWrap::post),
-                    InstanceMethod("nativeCall", &NativeObjectWrap::call) });
+                    InstanceMethod("nativePostChunk",
+                                   &NativeObjectWrap::postChunk),
+                    InstanceMethod("nativeCall", &NativeObjectWrap::call),
+                    InstanceMethod("nativeCallMany",
+                                   &NativeObjectWrap::callMany),
+                    InstanceMethod("nativeCancelCall",
+                                   &NativeObjectWrap::cancelCall),
+                    InstanceMethod("nativePostBatch",
+                                   &NativeObjectWrap::postBatch),
+                    InstanceMethod("nativePrepare", &NativeObjectWrap::prepare),
+                    InstanceMethod("nativePostPrepared",
+                                   &NativeObjectWrap::postPrepared),
+                    InstanceMethod("nativeSetPrepared",
+                                   &NativeObjectWrap::setPrepared),
+                    InstanceMethod("getQueueStats",
+                                   &NativeObjectWrap::getQueueStats),
+                    InstanceMethod("pendingCalls",
+                                   &NativeObjectWrap::pendingCalls),
+                    InstanceMethod("nativePeek", &NativeObjectWrap::peek) });
   exports.Set("Agent", ctor);
   return exports;
 }
 
 NativeObjectWrap::NativeObjectWrap(const CallbackInfo& info)
     : ObjectWrap<NativeObjectWrap>(info) {
+  ownerId = ++lastOwnerId;
+  if (info.Length() >= 2 && info[0].IsString() && info[1].IsObject()) {
+    Napi::Value v = info[1].As<Object>().Get("shareConnection");
+    shared = v.IsBoolean() && v.As<Boolean>().Value();
+  }
+  if (shared) {
+    // agents of different ids share one connection identified by id of
+    // agent created it first
+    std::string uri = std::string(info[0].As<String>());
+    size_t pos = uri.find('#');
+    if (pos != std::string::npos)
+      clientId = uri.substr(pos + 1);
+    auto key = std::make_pair((napi_env)info.Env(), uri.substr(0, pos));
+    std::lock_guard<std::mutex> locker(connectionPoolMutex);
+    auto it = connectionPool.find(key);
+    if (it != connectionPool.end()) {
+      std::string conflict = it->second->conflictingOption(info[1]);
+      if (!conflict.empty()) {
+        Error::New(info.Env(), "shareConnection option " + conflict +
+                                   " differs from agent created first")
+            .ThrowAsJavaScriptException();
+        return;
+      }
+      thisClient = it->second;
+      thisClient->attach();
+      return;
+    }
+    thisClient = new ClientNative();
+    thisClient->initialize(info, true);
+    // options conflict with connection of other thread
+    if (info.Env().IsExceptionPending()) {
+      delete thisClient;
+      thisClient = nullptr;
+      return;
+    }
+    thisClient->poolKey = key.second;
+    connectionPool[key] = thisClient;
+    return;
+  }
   thisClient = new ClientNative();
-  thisClient->initialize(info);
+  thisClient->initialize(info, false);
 }
 
 NativeObjectWrap::~NativeObjectWrap() {
   if (thisClient) {
-    thisClient->close();
+    thisClient->detach(ownerId);
   }
 }
 
 Napi::Value NativeObjectWrap::start(const Napi::CallbackInfo& info) {
   if (thisClient == nullptr)
     return info.Env().Undefined();
+  // connection may be started by other agent, keep this agent alive
+  // until closed as ClientNative::start does
+  if (shared && !started) {
+    Ref();
+    started = true;
+  }
   return thisClient->start(info);
 }
 
 Napi::Value NativeObjectWrap::subscribe(const Napi::CallbackInfo& info) {
   if (thisClient == nullptr)
     return info.Env().Undefined();
-  return thisClient->subscribe(info);
+  return thisClient->subscribe(info, ownerId);
 }
 
 Napi::Value NativeObjectWrap::unsubscribe(const Napi::CallbackInfo& info) {
   if (thisClient == nullptr)
     return info.Env().Undefined();
-  return thisClient->unsubscribe(info);
+  return thisClient->unsubscribe(info, ownerId);
 }
 
 Napi::Value NativeObjectWrap::declareMethod(const Napi::CallbackInfo& info) {
   if (thisClient == nullptr)
     return info.Env().Undefined();
-  return thisClient->declareMethod(info);
+  // flora routes calls by id of connection, methods of other ids
+  // could not be reached
+  if (shared && clientId != thisClient->clientId()) {
+    Error::New(info.Env(), "could not declare method of agent id '" +
+                               clientId + "' on connection shared with id '" +
+                               thisClient->clientId() + "'")
+        .ThrowAsJavaScriptException();
+    return info.Env().Undefined();
+  }
+  return thisClient->declareMethod(info, ownerId);
 }
 
 Napi::Value NativeObjectWrap::removeMethod(const Napi::CallbackInfo& info) {
   if (thisClient == nullptr)
     return info.Env().Undefined();
-  return thisClient->removeMethod(info);
+  return thisClient->removeMethod(info, ownerId);
 }
 
 Napi::Value NativeObjectWrap::close(const Napi::CallbackInfo& info) {
   ClientNative* tmp = thisClient;
   if (tmp) {
     thisClient = nullptr;
-    tmp->close();
+    tmp->detach(ownerId);
+    if (started) {
+      started = false;
+      Unref();
+    }
   }
   return info.Env().Undefined();
 }
@@ -115,18 +291,78 @@ Napi::Value NativeObjectWrap::getSocket(const Napi::CallbackInfo& info) {
   return thisClient->getSocket(info);
 }
 
+Napi::Value NativeObjectWrap::getQueueStats(const Napi::CallbackInfo& info) {
+  if (thisClient == nullptr)
+    return info.Env().Undefined();
+  return thisClient->getQueueStats(info);
+}
+
+Napi::Value NativeObjectWrap::pendingCalls(const Napi::CallbackInfo& info) {
+  if (thisClient == nullptr)
+    return info.Env().Undefined();
+  return thisClient->pendingCalls(info);
+}
+
+Napi::Value NativeObjectWrap::peek(const Napi::CallbackInfo& info) {
+  if (thisClient == nullptr)
+    return info.Env().Undefined();
+  return thisClient->peek(info);
+}
+
 Napi::Value NativeObjectWrap::post(const Napi::CallbackInfo& info) {
   if (thisClient == nullptr)
     return Number::New(info.Env(), ERROR_NOT_CONNECTED);
   return thisClient->post(info);
 }
 
+Napi::Value NativeObjectWrap::postChunk(const Napi::CallbackInfo& info) {
+  if (thisClient == nullptr)
+    return Number::New(info.Env(), ERROR_NOT_CONNECTED);
+  return thisClient->postChunk(info);
+}
+
 Napi::Value NativeObjectWrap::call(const Napi::CallbackInfo& info) {
   if (thisClient == nullptr)
     return Number::New(info.Env(), ERROR_NOT_CONNECTED);
   return thisClient->call(info);
 }
 
+Napi::Value NativeObjectWrap::callMany(const Napi::CallbackInfo& info) {
+  if (thisClient == nullptr)
+    return Number::New(info.Env(), ERROR_NOT_CONNECTED);
+  return thisClient->callMany(info);
+}
+
+Napi::Value NativeObjectWrap::cancelCall(const Napi::CallbackInfo& info) {
+  if (thisClient == nullptr)
+    return Boolean::New(info.Env(), false);
+  return thisClient->cancelCall(info);
+}
+
+Napi::Value NativeObjectWrap::postBatch(const Napi::CallbackInfo& info) {
+  if (thisClient == nullptr)
+    return Number::New(info.Env(), ERROR_NOT_CONNECTED);
+  return thisClient->postBatch(info);
+}
+
+Napi::Value NativeObjectWrap::prepare(const Napi::CallbackInfo& info) {
+  if (thisClient == nullptr)
+    return Number::New(info.Env(), ERROR_NOT_CONNECTED);
+  return thisClient->prepare(info);
+}
+
+Napi::Value NativeObjectWrap::postPrepared(const Napi::CallbackInfo& info) {
+  if (thisClient == nullptr)
+    return Number::New(info.Env(), ERROR_NOT_CONNECTED);
+  return thisClient->postPrepared(info);
+}
+
+Napi::Value NativeObjectWrap::setPrepared(const Napi::CallbackInfo& info) {
+  if (thisClient == nullptr)
+    return Number::New(info.Env(), ERROR_NOT_CONNECTED);
+  return thisClient->setPrepared(info);
+}
+
 Napi::Value NativeObjectWrap::genArray(const Napi::CallbackInfo& info) {
   if (thisClient == nullptr)
     return info.Env().Undefined();
@@ -135,12 +371,17 @@ Napi::Value NativeObjectWrap::genArray(const Napi::CallbackInfo& info) {
 
 #define DEFAULT_RECONN_INTERVAL 10000
 #define DEFAULT_BUFSIZE 32768
-typedef struct {
-  uint32_t reconnInterval;
-  uint32_t bufsize;
-  uint32_t beepInterval;
-  uint32_t norespTimeout;
-} AgentOptions;
+
+static uint32_t parseOverflowPolicy(const Napi::Value& v) {
+  if (v.IsString()) {
+    std::string policy = v.As<String>();
+    if (policy == "drop-newest")
+      return OVERFLOW_POLICY_DROP_NEWEST;
+    if (policy == "block")
+      return OVERFLOW_POLICY_BLOCK;
+  }
+  return OVERFLOW_POLICY_DROP_OLDEST;
+}
 
 static void parseAgentOptions(const Napi::Value& jsopts,
                               AgentOptions& cxxopts) {
@@ -169,15 +410,130 @@ static void parseAgentOptions(const Napi::Value& jsopts,
     } else {
       cxxopts.norespTimeout = FLORA_CLI_DEFAULT_NORESP_TIMEOUT;
     }
+    v = jsopts.As<Object>().Get("maxPendingMsgs");
+    if (v.IsNumber()) {
+      cxxopts.maxPendingMsgs = v.As<Number>().Uint32Value();
+    } else {
+      cxxopts.maxPendingMsgs = 0;
+    }
+    v = jsopts.As<Object>().Get("maxPendingBytes");
+    if (v.IsNumber()) {
+      cxxopts.maxPendingBytes = v.As<Number>().Uint32Value();
+    } else {
+      cxxopts.maxPendingBytes = 0;
+    }
+    cxxopts.overflowPolicy =
+        parseOverflowPolicy(jsopts.As<Object>().Get("overflowPolicy"));
+    v = jsopts.As<Object>().Get("dispatchBudgetMsgs");
+    if (v.IsNumber()) {
+      cxxopts.dispatchBudgetMsgs = v.As<Number>().Uint32Value();
+    } else {
+      cxxopts.dispatchBudgetMsgs = 0;
+    }
+    v = jsopts.As<Object>().Get("dispatchBudgetUs");
+    if (v.IsNumber()) {
+      cxxopts.dispatchBudgetUs = v.As<Number>().Uint32Value();
+    } else {
+      cxxopts.dispatchBudgetUs = 0;
+    }
+    v = jsopts.As<Object>().Get("numberEncoding");
+    if (v.IsString() && std::string(v.As<String>()) == "double") {
+      cxxopts.encodeFlags = CAPS_ENCODE_ALWAYS_DOUBLE;
+    } else {
+      cxxopts.encodeFlags = 0;
+    }
+    v = jsopts.As<Object>().Get("sharedMemory");
+    if (v.IsBoolean() && v.As<Boolean>().Value()) {
+      cxxopts.encodeFlags |= CAPS_ENCODE_SHARED_MEMORY;
+    }
+    v = jsopts.As<Object>().Get("predecode");
+    cxxopts.predecode = v.IsBoolean() && v.As<Boolean>().Value();
+    v = jsopts.As<Object>().Get("fragment");
+    cxxopts.fragment = v.IsBoolean() && v.As<Boolean>().Value();
   } else {
     cxxopts.reconnInterval = DEFAULT_RECONN_INTERVAL;
     cxxopts.bufsize = DEFAULT_BUFSIZE;
     cxxopts.beepInterval = FLORA_CLI_DEFAULT_BEEP_INTERVAL;
     cxxopts.norespTimeout = FLORA_CLI_DEFAULT_NORESP_TIMEOUT;
+    cxxopts.maxPendingMsgs = 0;
+    cxxopts.maxPendingBytes = 0;
+    cxxopts.overflowPolicy = OVERFLOW_POLICY_DROP_OLDEST;
+    cxxopts.dispatchBudgetMsgs = 0;
+    cxxopts.dispatchBudgetUs = 0;
+    cxxopts.encodeFlags = 0;
+    cxxopts.predecode = false;
+    cxxopts.fragment = false;
   }
 }
 
-void ClientNative::initialize(const CallbackInfo& info) {
+static bool optionGiven(const Napi::Value& jsopts, const char* name) {
+  return jsopts.IsObject() && !jsopts.As<Object>().Get(name).IsUndefined();
+}
+
+// name of connection option given by jsopts and different from options
+// connection created with, empty if none
+static std::string connectionConflict(const Napi::Value& jsopts,
+                                      const FloraConnection& conn) {
+  AgentOptions opts;
+  parseAgentOptions(jsopts, opts);
+  if (optionGiven(jsopts, "reconnInterval") &&
+      opts.reconnInterval != conn.reconnInterval)
+    return "reconnInterval";
+  if (optionGiven(jsopts, "bufsize") && opts.bufsize != conn.bufsize)
+    return "bufsize";
+  if (optionGiven(jsopts, "beepInterval") &&
+      opts.beepInterval != conn.beepInterval)
+    return "beepInterval";
+  if (optionGiven(jsopts, "norespTimeout") &&
+      opts.norespTimeout != conn.norespTimeout)
+    return "norespTimeout";
+  return std::string();
+}
+
+// name of option given by jsopts and different from options of agent
+// created this client, empty if none
+std::string ClientNative::conflictingOption(const Napi::Value& jsopts) {
+  std::string conflict = connectionConflict(jsopts, *connection);
+  if (!conflict.empty())
+    return conflict;
+  AgentOptions opts;
+  parseAgentOptions(jsopts, opts);
+  const AgentOptions& cur = agentOptions;
+  if (optionGiven(jsopts, "maxPendingMsgs") &&
+      opts.maxPendingMsgs != cur.maxPendingMsgs)
+    return "maxPendingMsgs";
+  if (optionGiven(jsopts, "maxPendingBytes") &&
+      opts.maxPendingBytes != cur.maxPendingBytes)
+    return "maxPendingBytes";
+  if (optionGiven(jsopts, "overflowPolicy") &&
+      opts.overflowPolicy != cur.overflowPolicy)
+    return "overflowPolicy";
+  if (optionGiven(jsopts, "dispatchBudgetMsgs") &&
+      opts.dispatchBudgetMsgs != cur.dispatchBudgetMsgs)
+    return "dispatchBudgetMsgs";
+  if (optionGiven(jsopts, "dispatchBudgetUs") &&
+      opts.dispatchBudgetUs != cur.dispatchBudgetUs)
+    return "dispatchBudgetUs";
+  if (optionGiven(jsopts, "numberEncoding") &&
+      (opts.encodeFlags & CAPS_ENCODE_ALWAYS_DOUBLE) !=
+          (cur.encodeFlags & CAPS_ENCODE_ALWAYS_DOUBLE))
+    return "numberEncoding";
+  if (optionGiven(jsopts, "sharedMemory") &&
+      (opts.encodeFlags & CAPS_ENCODE_SHARED_MEMORY) !=
+          (cur.encodeFlags & CAPS_ENCODE_SHARED_MEMORY))
+    return "sharedMemory";
+  if (optionGiven(jsopts, "predecode") && opts.predecode != cur.predecode)
+    return "predecode";
+  if (optionGiven(jsopts, "fragment") && opts.fragment != cur.fragment)
+    return "fragment";
+  return std::string();
+}
+
+const std::string& ClientNative::clientId() const {
+  return connection->clientId;
+}
+
+void ClientNative::initialize(const CallbackInfo& info, bool shared) {
   Napi::Env env = info.Env();
   thisEnv = env;
   HandleScope scope(env);
@@ -187,14 +543,89 @@ void ClientNative::initialize(const CallbackInfo& info) {
     return;
   }
   std::string uri = std::string(info[0].As<String>());
-  floraAgent.config(FLORA_AGENT_CONFIG_URI, uri.c_str());
+  size_t pos = uri.find('#');
+  dispatcherUri = uri.substr(0, pos);
 
-  AgentOptions opts;
+  AgentOptions& opts = agentOptions;
   parseAgentOptions(info[1], opts);
-  floraAgent.config(FLORA_AGENT_CONFIG_RECONN_INTERVAL, opts.reconnInterval);
-  floraAgent.config(FLORA_AGENT_CONFIG_BUFSIZE, opts.bufsize);
-  floraAgent.config(FLORA_AGENT_CONFIG_KEEPALIVE, opts.beepInterval,
-                    opts.norespTimeout);
+  // shared connection created by agent of other thread first keeps its
+  // id and options
+  connection = FloraConnection::acquire(
+      shared ? dispatcherUri : uri, shared, this,
+      [&uri, pos, &opts](FloraConnection& conn) {
+        conn.agent.config(FLORA_AGENT_CONFIG_URI, uri.c_str());
+        conn.agent.config(FLORA_AGENT_CONFIG_RECONN_INTERVAL,
+                          opts.reconnInterval);
+        conn.agent.config(FLORA_AGENT_CONFIG_BUFSIZE, opts.bufsize);
+        conn.agent.config(FLORA_AGENT_CONFIG_KEEPALIVE, opts.beepInterval,
+                          opts.norespTimeout);
+        if (pos != std::string::npos)
+          conn.clientId = uri.substr(pos + 1);
+        conn.reconnInterval = opts.reconnInterval;
+        conn.bufsize = opts.bufsize;
+        conn.beepInterval = opts.beepInterval;
+        conn.norespTimeout = opts.norespTimeout;
+      });
+  std::string conflict = connectionConflict(info[1], *connection);
+  if (!conflict.empty()) {
+    connection->release(this);
+    connection.reset();
+    Error::New(env, "shareConnection option " + conflict +
+                        " differs from agent created first")
+        .ThrowAsJavaScriptException();
+    return;
+  }
+  usePersistMsgs(dispatcherUri);
+  // client set when started, callbacks of a connection started by other
+  // thread ignored before async handles initialized
+  anchor = make_shared<ClientAnchor>();
+  maxPendingMsgs = opts.maxPendingMsgs;
+  maxPendingBytes = opts.maxPendingBytes;
+  overflowPolicy = opts.overflowPolicy;
+  dispatchBudgetMsgs = opts.dispatchBudgetMsgs;
+  dispatchBudgetUs = opts.dispatchBudgetUs;
+  encodeFlags = opts.encodeFlags;
+  predecode = opts.predecode;
+  // memfd could only be opened by processes on same host
+  if (uri.compare(0, 5, "unix:") != 0)
+    encodeFlags &= ~CAPS_ENCODE_SHARED_MEMORY;
+  // acks of receivers release memfds posted by any agent of this process
+  if (encodeFlags & CAPS_ENCODE_SHARED_MEMORY) {
+    static std::atomic<uint32_t> shmReceivers{ 0 };
+    shmReceiver = ((int64_t)getpid() << 32) | ++shmReceivers;
+    std::string uri = dispatcherUri;
+    connection->subscribe(
+        SHM_ACK_PREFIX + std::to_string(getpid()), this,
+        [uri](const char*, shared_ptr<Caps>& msg, uint32_t) {
+          std::string name;
+          int64_t receiver;
+          int64_t ino;
+          if (msg.get() == nullptr ||
+              msg->read_string(name) != CAPS_SUCCESS ||
+              msg->read(receiver) != CAPS_SUCCESS)
+            return;
+          std::string key = uri + '\0' + name;
+          if (msg->next_type() == CAPS_ERR_EOO)
+            ackShmBinary(key, receiver, 0);
+          while (msg->read(ino) == CAPS_SUCCESS)
+            ackShmBinary(key, receiver, ino);
+        });
+  }
+  // fragments decoded by agents of this module only, posted if agent
+  // opted in. 0 means flora default size
+  if (opts.fragment) {
+    bufsize = connection->bufsize;
+    if (bufsize == 0)
+      bufsize = DEFAULT_BUFSIZE;
+  }
+  // drop-oldest evicts on flora thread while js thread pops
+  bool evictable = overflowPolicy == OVERFLOW_POLICY_DROP_OLDEST &&
+                   (maxPendingMsgs > 0 || maxPendingBytes > 0);
+  if (maxPendingMsgs > 0 && maxPendingMsgs < DEFAULT_PENDING_QUEUE_CAPACITY)
+    pendingMsgs.init(maxPendingMsgs, evictable);
+  else
+    pendingMsgs.init(DEFAULT_PENDING_QUEUE_CAPACITY, evictable);
+  pendingResponses.init(DEFAULT_PENDING_QUEUE_CAPACITY);
   status |= NATIVE_STATUS_CONFIGURED;
 }
 
@@ -208,16 +639,174 @@ Value ClientNative::start(const CallbackInfo& info) {
     uv_async_init(loop, &msgAsync, msg_async_cb);
     respAsync.data = this;
     uv_async_init(loop, &respAsync, resp_async_cb);
+    trailingTimer.data = this;
+    uv_timer_init(loop, &trailingTimer);
     napi_async_init(env, info.This(), String::New(env, "flora-agent"),
                     &asyncContext);
-    floraAgent.start();
+    asyncHandleCount = ASYNC_HANDLE_COUNT;
+    anchor->mutex.lock();
+    anchor->client = this;
+    anchor->mutex.unlock();
+    connection->start();
+#if NAPI_VERSION >= 3
+    napi_add_env_cleanup_hook(env, env_cleanup_cb, this);
+#endif
     thisRef = Napi::Persistent(info.This());
     status |= NATIVE_STATUS_STARTED;
+    if (!replays.empty())
+      uv_async_send(&msgAsync);
   }
   return env.Undefined();
 }
 
-Value ClientNative::subscribe(const CallbackInfo& info) {
+// evaluated on flora thread
+// throttled has bits of maxRate handlers dropped msg in current interval
+static bool matchHandlers(const SubscriptionHandlers& hs,
+                          std::shared_ptr<Caps>& msg, uint64_t seq,
+                          uint64_t& mask, uint64_t& throttled) {
+  bool any = false;
+  size_t i;
+  throttled = 0;
+  if (!hs.filtered && !hs.limited) {
+    mask = ~(uint64_t)0;
+    return !hs.ids.empty();
+  }
+  uint64_t now = hs.limited ? uv_hrtime() : 0;
+  mask = 0;
+  for (i = 0; i < hs.filters.size(); ++i) {
+    if (hs.filters[i] && !matchMsgFilter(*hs.filters[i], msg))
+      continue;
+    if (i < MAX_MASKED_HANDLERS && hs.limits[i]) {
+      HandlerLimit& limit = *hs.limits[i];
+      if (limit.minIntervalNs > 0) {
+        uint64_t last = limit.lastTime.load();
+        if (last != 0 && now - last < limit.minIntervalNs) {
+          throttled |= (uint64_t)1 << i;
+          continue;
+        }
+        limit.lastTime.store(now);
+        limit.passedSeq.store(seq);
+      }
+    }
+    any = true;
+    if (i < MAX_MASKED_HANDLERS)
+      mask |= (uint64_t)1 << i;
+  }
+  return any;
+}
+
+// add handler id with filter, limit, priority, whether it wants sender and
+// whether it takes stream chunks, or remove handler id if it exists
+void ClientNative::updateHandlers(Subscription& sub, uint32_t id,
+                                  shared_ptr<MsgFilter> filter,
+                                  shared_ptr<HandlerLimit> limit,
+                                  uint32_t priority, bool sender,
+                                  bool stream) {
+  shared_ptr<const SubscriptionHandlers> cur =
+      std::atomic_load(&sub.shared->current);
+  shared_ptr<SubscriptionHandlers> hs = make_shared<SubscriptionHandlers>();
+  bool removed = false;
+  size_t i;
+  if (cur) {
+    for (i = 0; i < cur->ids.size(); ++i) {
+      if (cur->ids[i] == id) {
+        removed = true;
+        continue;
+      }
+      hs->ids.push_back(cur->ids[i]);
+      hs->filters.push_back(cur->filters[i]);
+      hs->limits.push_back(cur->limits[i]);
+      hs->priorities.push_back(cur->priorities[i]);
+      hs->senders.push_back(cur->senders[i]);
+      hs->streams.push_back(cur->streams[i]);
+      if (cur->priorities[i] < hs->lane)
+        hs->lane = cur->priorities[i];
+      if (cur->senders[i])
+        hs->anySender = true;
+      if (cur->streams[i])
+        hs->stream = true;
+      if (cur->filters[i])
+        hs->filtered = true;
+      if (cur->limits[i])
+        hs->limited = true;
+    }
+  }
+  if (!removed) {
+    hs->ids.push_back(id);
+    hs->filters.push_back(filter);
+    hs->limits.push_back(limit);
+    hs->priorities.push_back(priority);
+    hs->senders.push_back(sender);
+    hs->streams.push_back(stream);
+    if (priority < hs->lane)
+      hs->lane = priority;
+    if (sender)
+      hs->anySender = true;
+    if (stream)
+      hs->stream = true;
+    if (filter)
+      hs->filtered = true;
+    if (limit)
+      hs->limited = true;
+  }
+  std::atomic_store(&sub.shared->current,
+                    shared_ptr<const SubscriptionHandlers>(hs));
+}
+
+// 'high' | 'normal' | 'low' of subscribe, declareMethod and call options
+static uint32_t parsePriority(const Napi::Value& v) {
+  if (!v.IsString())
+    return PRIORITY_NORMAL;
+  std::string s = v.As<String>();
+  if (s == "high")
+    return PRIORITY_HIGH;
+  if (s == "low")
+    return PRIORITY_LOW;
+  return PRIORITY_NORMAL;
+}
+
+static uint32_t parsePriorityOption(const Napi::Value& opts) {
+  if (!opts.IsObject())
+    return PRIORITY_NORMAL;
+  return parsePriority(opts.As<Object>().Get("priority"));
+}
+
+// option sender: false of subscribe and declareMethod
+static bool parseSenderOption(const Napi::Value& opts) {
+  if (!opts.IsObject())
+    return true;
+  Napi::Value v = opts.As<Object>().Get("sender");
+  return !v.IsBoolean() || v.As<Boolean>().Value();
+}
+
+// option stream: true of declareMethod, method called by Agent.callStream.
+// of subscribe, handler of chunks of Agent.callStream
+static bool parseStreamOption(const Napi::Value& opts) {
+  if (!opts.IsObject())
+    return false;
+  Napi::Value v = opts.As<Object>().Get("stream");
+  return v.IsBoolean() && v.As<Boolean>().Value();
+}
+
+// { maxRate, coalesce } of subscribe options, nullptr if no limit
+static shared_ptr<HandlerLimit> parseHandlerLimit(const Napi::Value& v) {
+  if (!v.IsObject())
+    return nullptr;
+  Object obj = v.As<Object>();
+  shared_ptr<HandlerLimit> limit = make_shared<HandlerLimit>();
+  Napi::Value rate = obj.Get("maxRate");
+  if (rate.IsNumber() && rate.As<Number>().DoubleValue() > 0)
+    limit->minIntervalNs =
+        static_cast<uint64_t>(1e9 / rate.As<Number>().DoubleValue());
+  Napi::Value coalesce = obj.Get("coalesce");
+  if (coalesce.IsString() && std::string(coalesce.As<String>()) == "latest")
+    limit->latestOnly = true;
+  if (limit->minIntervalNs == 0 && !limit->latestOnly)
+    return nullptr;
+  return limit;
+}
+
+Value ClientNative::subscribe(const CallbackInfo& info, uint32_t owner) {
   Napi::Env env = info.Env();
   if (!(status & NATIVE_STATUS_CONFIGURED))
     return env.Undefined();
@@ -227,22 +816,217 @@ Value ClientNative::subscribe(const CallbackInfo& info) {
     return env.Undefined();
   }
   std::string name = std::string(info[0].As<String>());
-  if (subscriptions.find(name) != subscriptions.end())
+  shared_ptr<MsgFilter> filter;
+  if (!info[2].IsUndefined() && !info[2].IsNull() &&
+      !parseMsgFilter(env, info[2], filter)) {
     return env.Undefined();
+  }
   Function cb = info[1].As<Function>();
-  auto r = subscriptions.insert(std::make_pair(name, Napi::Persistent(cb)));
-  if (!r.second) {
-    return env.Undefined();
+  uint32_t topic = topics.intern(name);
+  if (topic >= subscriptions.size())
+    subscriptions.resize(topic + 1);
+  bool first = subscriptions[topic] == nullptr;
+  if (first)
+    subscriptions[topic].reset(new Subscription());
+  Subscription& sub = *subscriptions[topic];
+  uint32_t id = ++lastHandlerId;
+  HandlerCallback& hcb = sub.callbacks[id];
+  hcb.fn = Napi::Persistent(cb);
+  hcb.owner = owner;
+  if (first)
+    sub.shared = make_shared<SharedHandlers>();
+  updateHandlers(sub, id, filter, parseHandlerLimit(info[3]),
+                 parsePriorityOption(info[3]), parseSenderOption(info[3]),
+                 parseStreamOption(info[3]));
+  bool subscribed = false;
+  if (first) {
+    shared_ptr<SharedHandlers> shared = sub.shared;
+    shared_ptr<ClientAnchor> anchor = this->anchor;
+    subscribed = connection->subscribe(
+        name, this, [anchor, env, shared, topic](const char* name,
+                                                 std::shared_ptr<Caps>& msg,
+                                                 uint32_t type) {
+          shared_ptr<SharedHandlers> s = shared;
+          std::lock_guard<std::mutex> locker(anchor->mutex);
+          if (anchor->client)
+            anchor->client->floraMsgCallback(topic, name, env, s, msg, type);
+        });
   }
-  floraAgent.subscribe(name.c_str(),
-                       [this, env](const char* name, std::shared_ptr<Caps>& msg,
-                                   uint32_t type) {
-                         this->msgCallback(name, env, msg, type, nullptr);
-                       });
-  return env.Undefined();
+  // name subscribed by other handlers of this agent or by other agents
+  // sharing the connection, flora replays no persist msg
+  if (!subscribed)
+    replayPersistMsg(env, topic, name, id);
+  return Number::New(env, id);
+}
+
+// last persist msg of name seen by agents of this process, dispatched to
+// handler id only
+void ClientNative::replayPersistMsg(Napi::Env env, uint32_t topic,
+                                    const std::string& name, uint32_t id) {
+  shared_ptr<Caps> msg;
+  if (!peekPersistMsg(dispatcherUri, name, msg))
+    return;
+  shared_ptr<const SubscriptionHandlers> cur =
+      std::atomic_load(&subscriptions[topic]->shared->current);
+  shared_ptr<SubscriptionHandlers> hs = make_shared<SubscriptionHandlers>();
+  size_t i;
+  for (i = 0; cur && i < cur->ids.size(); ++i) {
+    if (cur->ids[i] != id)
+      continue;
+    if (cur->filters[i] && !matchMsgFilter(*cur->filters[i], msg))
+      return;
+    hs->ids.push_back(id);
+    hs->filters.push_back(cur->filters[i]);
+    hs->limits.push_back(nullptr);
+    hs->priorities.push_back(cur->priorities[i]);
+    hs->senders.push_back(false);
+    hs->streams.push_back(cur->streams[i]);
+    hs->lane = cur->priorities[i];
+  }
+  if (hs->ids.empty())
+    return;
+  MsgCallbackInfo cbinfo(env);
+  initMsgCallbackInfo(cbinfo, topic, msg, FLORA_MSGTYPE_PERSIST, hs, 1, 0,
+                      hs->lane, false, true, nullptr);
+  replays.push_back(std::move(cbinfo));
+  // dispatched once started otherwise
+  if (status & NATIVE_STATUS_STARTED)
+    uv_async_send(&msgAsync);
+}
+
+// invoked on flora thread, msg not read by other threads
+void ClientNative::floraMsgCallback(uint32_t topic, const char* name,
+                                    Napi::Env env,
+                                    shared_ptr<SharedHandlers>& shared,
+                                    shared_ptr<Caps>& msg, uint32_t type) {
+  shared_ptr<const SubscriptionHandlers> hs =
+      std::atomic_load(&shared->current);
+  uint64_t mask;
+  uint64_t throttled;
+  uint64_t seq = ++lastMsgSeq;
+  // msg replaced by reassembled one on last fragment,
+  // which is parsed from a copy and owns its storage
+  Caps* received = msg.get();
+  if (!fragments.feed(name, msg))
+    return;
+  bool ownsStorage = msg.get() != received;
+  // cached before filters, value of msg name for Agent.peek
+  if (type == FLORA_MSGTYPE_PERSIST)
+    cachePersistMsg(dispatcherUri, name, msg);
+  if (!hs)
+    return;
+  // drop msgs not wanted before any allocation
+  bool matched = matchHandlers(*hs, msg, seq, mask, throttled);
+  shared_ptr<ShmBinaries> shm;
+  if (!mapShm(name, msg, matched || throttled, shm))
+    return;
+  if (throttled)
+    keepTrailing(topic, env, msg, type, hs, throttled, seq, ownsStorage, shm);
+  if (!matched)
+    return;
+  // all msgs of a name in one lane, whichever handlers matched, so
+  // handlers see them in order
+  if (!msgCallback(topic, name, env, msg, type, nullptr, hs, mask, seq,
+                   hs->lane, hs->anySender, ownsStorage, shm) ||
+      !hs->limited)
+    return;
+  // coalesce 'latest': older msgs skipped once this one is queued,
+  // a dropped msg never hides older ones
+  size_t i;
+  for (i = 0; i < hs->limits.size() && i < MAX_MASKED_HANDLERS; ++i) {
+    if (hs->limits[i] && hs->limits[i]->latestOnly &&
+        (mask & ((uint64_t)1 << i)))
+      hs->limits[i]->latestSeq.store(seq);
+  }
+}
+
+// newest msg dropped by maxRate kept for each throttled handler,
+// dispatched by trailingTimer when interval of handler ends
+void ClientNative::keepTrailing(uint32_t topic, Napi::Env env,
+                                shared_ptr<Caps>& msg, uint32_t type,
+                                shared_ptr<const SubscriptionHandlers>& hs,
+                                uint64_t throttled, uint64_t seq,
+                                bool ownsStorage,
+                                shared_ptr<ShmBinaries>& shm) {
+  MsgCallbackInfo cbinfo(env);
+  // not predecoded, trailing msgs decoded on js thread
+  initMsgCallbackInfo(cbinfo, topic, msg, type, hs, 0, seq, hs->lane,
+                      hs->anySender, ownsStorage, shm);
+  std::lock_guard<std::mutex> locker(trailingMutex);
+  size_t i;
+  for (i = 0; i < hs->limits.size() && i < MAX_MASKED_HANDLERS; ++i) {
+    if (!(throttled & ((uint64_t)1 << i)))
+      continue;
+    const shared_ptr<HandlerLimit>& limit = hs->limits[i];
+    if (!limit->trailing)
+      trailingLimits.push_back(limit);
+    limit->trailing = make_shared<MsgCallbackInfo>(cbinfo);
+    limit->trailing->handlerMask = (uint64_t)1 << i;
+    if (limit->latestOnly)
+      limit->latestSeq.store(seq);
+  }
+  trailingChanged = true;
+  uv_async_send(&msgAsync);
+}
+
+// js thread, timer due when first interval of trailing msgs ends
+void ClientNative::scheduleTrailing() {
+  uint64_t due = UINT64_MAX;
+  {
+    std::lock_guard<std::mutex> locker(trailingMutex);
+    for (auto it = trailingLimits.begin(); it != trailingLimits.end(); ++it) {
+      uint64_t end = (*it)->lastTime.load() + (*it)->minIntervalNs;
+      if (end < due)
+        due = end;
+    }
+  }
+  if (due == UINT64_MAX)
+    return;
+  uint64_t now = uv_hrtime();
+  uint64_t timeout = due > now ? (due - now + 999999) / 1000000 : 0;
+  uv_timer_start(&trailingTimer, trailing_timer_cb, timeout, 0);
+}
+
+void ClientNative::dispatchTrailing() {
+  if (!(status & NATIVE_STATUS_STARTED))
+    return;
+  std::vector<shared_ptr<MsgCallbackInfo>> due;
+  uint64_t now = uv_hrtime();
+  {
+    std::lock_guard<std::mutex> locker(trailingMutex);
+    auto it = trailingLimits.begin();
+    while (it != trailingLimits.end()) {
+      HandlerLimit& limit = **it;
+      if (now - limit.lastTime.load() < limit.minIntervalNs) {
+        ++it;
+        continue;
+      }
+      // newer msg passed meanwhile, trailing one outdated
+      if (limit.passedSeq.load() < limit.trailing->seq) {
+        // counts as passed, next msg in interval dropped again
+        limit.lastTime.store(now);
+        due.push_back(limit.trailing);
+      }
+      limit.trailing.reset();
+      it = trailingLimits.erase(it);
+    }
+  }
+  for (auto it = due.begin(); it != due.end(); ++it) {
+    MsgCallbackInfo& cbinfo = **it;
+    // msg object may be read by lazy msgs of handlers it passed
+    if (cbinfo.msg.get()) {
+      cbinfo.msg = FloraConnection::cloneCaps(cbinfo.msg);
+      cbinfo.ownsStorage = true;
+      if (cbinfo.msg == nullptr)
+        continue;
+    }
+    HandleScope scope(cbinfo.env);
+    dispatchMsg(cbinfo);
+  }
+  scheduleTrailing();
 }
 
-Value ClientNative::unsubscribe(const CallbackInfo& info) {
+Value ClientNative::unsubscribe(const CallbackInfo& info, uint32_t owner) {
   Napi::Env env = info.Env();
   if (!(status & NATIVE_STATUS_CONFIGURED))
     return env.Undefined();
@@ -251,16 +1035,39 @@ Value ClientNative::unsubscribe(const CallbackInfo& info) {
     return env.Undefined();
   }
   std::string name = std::string(info[0].As<String>());
-  SubscriptionMap::iterator it = subscriptions.find(name);
-  if (it != subscriptions.end()) {
-    it->second.Unref();
-    subscriptions.erase(it);
+  uint32_t topic;
+  if (topics.find(name, topic) && topic < subscriptions.size() &&
+      subscriptions[topic]) {
+    // remove one handler, or all handlers of owner.
+    // keep flora subscription if any handler left
+    Subscription& sub = *subscriptions[topic];
+    std::map<uint32_t, HandlerCallback>& callbacks = sub.callbacks;
+    auto cbit = callbacks.begin();
+    if (info[1].IsNumber())
+      cbit = callbacks.find(info[1].As<Number>().Uint32Value());
+    while (cbit != callbacks.end()) {
+      uint32_t id = cbit->first;
+      if (cbit->second.owner != owner) {
+        if (info[1].IsNumber())
+          break;
+        ++cbit;
+        continue;
+      }
+      cbit = callbacks.erase(cbit);
+      updateHandlers(sub, id, nullptr, nullptr, PRIORITY_NORMAL, true, false);
+      if (info[1].IsNumber())
+        break;
+    }
+    if (!callbacks.empty())
+      return env.Undefined();
+    subscriptions[topic].reset();
+    releaseTopic(topic);
   }
-  floraAgent.unsubscribe(name.c_str());
+  connection->unsubscribe(name, this);
   return env.Undefined();
 }
 
-Value ClientNative::declareMethod(const CallbackInfo& info) {
+Value ClientNative::declareMethod(const CallbackInfo& info, uint32_t owner) {
   Napi::Env env = info.Env();
   if (!(status & NATIVE_STATUS_CONFIGURED))
     return env.Undefined();
@@ -270,184 +1077,1089 @@ Value ClientNative::declareMethod(const CallbackInfo& info) {
     return env.Undefined();
   }
   std::string name = std::string(info[0].As<String>());
-  if (remoteMethods.find(name) != remoteMethods.end())
+  uint32_t topic = topics.intern(name);
+  if (topic >= remoteMethods.size())
+    remoteMethods.resize(topic + 1);
+  if (remoteMethods[topic])
     return env.Undefined();
   Function cb = info[1].As<Function>();
-  auto r = remoteMethods.insert(std::make_pair(name, Napi::Persistent(cb)));
-  if (!r.second) {
+  remoteMethods[topic].reset(new HandlerCallback());
+  HandlerCallback& hcb = *remoteMethods[topic];
+  hcb.fn = Napi::Persistent(cb);
+  hcb.owner = owner;
+  hcb.stream = parseStreamOption(info[2]);
+  hcb.id = ++lastHandlerId;
+  uint32_t id = hcb.id;
+  uint32_t lane = parsePriorityOption(info[2]);
+  bool sender = parseSenderOption(info[2]);
+  shared_ptr<ClientAnchor> anchor = this->anchor;
+  bool declared = connection->declareMethod(
+      name, this,
+      [anchor, env, topic, id, lane, sender](const char* name,
+                                             shared_ptr<Caps>& msg,
+                                             shared_ptr<Reply>& reply) {
+        std::lock_guard<std::mutex> locker(anchor->mutex);
+        if (anchor->client)
+          anchor->client->msgCallback(topic, name, env, msg, 0xffffffff, reply,
+                                      nullptr, 0, id, lane, sender);
+      });
+  // declared by agent of other thread sharing the connection
+  if (!declared) {
+    remoteMethods[topic].reset();
+    releaseTopic(topic);
+  }
+  return env.Undefined();
+}
+
+Value ClientNative::removeMethod(const CallbackInfo& info, uint32_t owner) {
+  Napi::Env env = info.Env();
+  if (!(status & NATIVE_STATUS_CONFIGURED))
+    return env.Undefined();
+  if (info.Length() < 1 || !info[0].IsString()) {
+    TypeError::New(env, "String excepted").ThrowAsJavaScriptException();
+    return env.Undefined();
+  }
+  std::string name = std::string(info[0].As<String>());
+  uint32_t topic;
+  if (topics.find(name, topic) && remoteMethods.size() > topic &&
+      remoteMethods[topic]) {
+    // declared by other agent of shared connection
+    if (remoteMethods[topic]->owner != owner)
+      return env.Undefined();
+    remoteMethods[topic].reset();
+    releaseTopic(topic);
+  }
+  connection->removeMethod(name, this);
+  return env.Undefined();
+}
+
+void ClientNative::attach() {
+  ++attachCount;
+}
+
+void ClientNative::detach(uint32_t owner) {
+  if (--attachCount == 0) {
+    if (!poolKey.empty()) {
+      std::lock_guard<std::mutex> locker(connectionPoolMutex);
+      connectionPool.erase(std::make_pair(thisEnv, poolKey));
+    }
+    close();
+    // async handles never initialized, or closed by env cleanup already
+    if (asyncHandleCount == 0)
+      delete this;
+    return;
+  }
+  uint32_t topic;
+  for (topic = 0; topic < subscriptions.size(); ++topic) {
+    if (!subscriptions[topic])
+      continue;
+    Subscription& sub = *subscriptions[topic];
+    std::map<uint32_t, HandlerCallback>& callbacks = sub.callbacks;
+    auto cbit = callbacks.begin();
+    while (cbit != callbacks.end()) {
+      if (cbit->second.owner == owner) {
+        updateHandlers(sub, cbit->first, nullptr, nullptr, PRIORITY_NORMAL,
+                       true, false);
+        cbit = callbacks.erase(cbit);
+      } else {
+        ++cbit;
+      }
+    }
+    if (callbacks.empty()) {
+      connection->unsubscribe(topics.name(topic), this);
+      subscriptions[topic].reset();
+      releaseTopic(topic);
+    }
+  }
+  for (topic = 0; topic < remoteMethods.size(); ++topic) {
+    if (remoteMethods[topic] && remoteMethods[topic]->owner == owner) {
+      connection->removeMethod(topics.name(topic), this);
+      remoteMethods[topic].reset();
+      releaseTopic(topic);
+    }
+  }
+}
+
+// topic id reused by names subscribed or declared later. msgs queued for
+// the old name carry handler ids not in new subscription, and method id
+void ClientNative::releaseTopic(uint32_t topic) {
+  if ((topic < subscriptions.size() && subscriptions[topic]) ||
+      (topic < remoteMethods.size() && remoteMethods[topic]))
+    return;
+  topics.release(topic);
+}
+
+void ClientNative::close() {
+  // closed already, async handles wait for callbacks of rejected calls.
+  // js not callable any more if env torn down
+  if (handlesClosePending) {
+    if (envTearingDown)
+      closeHandles();
+    return;
+  }
+  // connection acquired but never started, no async handle to close.
+  // calls fail before started, none tracked
+  if ((status & NATIVE_STATUS_CONFIGURED) &&
+      !(status & NATIVE_STATUS_STARTED)) {
+    connection->release(this);
+    unusePersistMsgs(dispatcherUri);
+    status &= (~NATIVE_STATUS_CONFIGURED);
+    return;
+  }
+  if ((status & NATIVE_STATUS_CONFIGURED) && (status & NATIVE_STATUS_STARTED)) {
+    // flora thread may be blocked by OVERFLOW_POLICY_BLOCK
+    closing = true;
+    block_mutex.lock();
+    block_cond.notify_all();
+    block_mutex.unlock();
+    // flora callbacks of this client never invoked after anchor cleared,
+    // agent closed if no client of other thread use the connection
+    anchor->mutex.lock();
+    anchor->client = nullptr;
+    anchor->mutex.unlock();
+    connection->release(this);
+    unusePersistMsgs(dispatcherUri);
+#if NAPI_VERSION >= 3
+    if (!envTearingDown)
+      napi_remove_env_cleanup_hook(thisEnv, env_cleanup_cb, this);
+#endif
+    // close may be invoked by finalizer of agent, js not callable here.
+    // callbacks of calls rejected invoked by respAsync from loop, async
+    // handles closed after that. js not callable while env torn down
+    rejectPendingCalls();
+    trailingMutex.lock();
+    for (auto it = trailingLimits.begin(); it != trailingLimits.end(); ++it)
+      (*it)->trailing.reset();
+    trailingLimits.clear();
+    trailingMutex.unlock();
+    uv_timer_stop(&trailingTimer);
+    subscriptions.clear();
+    clearSenderObjects();
+    thisRef.Unref();
+    status &= (~NATIVE_STATUS_STARTED);
+    handlesClosePending = true;
+    if (envTearingDown)
+      closeHandles();
+    else
+      uv_async_send(&respAsync);
+  }
+}
+
+void ClientNative::closeHandles() {
+  handlesClosePending = false;
+  uv_close((uv_handle_t*)&msgAsync, async_close_cb);
+  uv_close((uv_handle_t*)&respAsync, async_close_cb);
+  uv_close((uv_handle_t*)&trailingTimer, async_close_cb);
+  napi_async_destroy(thisEnv, asyncContext);
+  asyncContext = nullptr;
+}
+
+// env cleanup hooks run before handles of worker loop closed,
+// ClientNative deleted when agent finalized
+void ClientNative::envCleanup() {
+  envTearingDown = true;
+  close();
+}
+
+Value ClientNative::getSocket(const CallbackInfo& info) {
+  auto fd = connection->agent.get_socket();
+  if (fd < 0)
+    return info.Env().Undefined();
+  return Number::New(info.Env(), fd);
+}
+
+Value ClientNative::getQueueStats(const CallbackInfo& info) {
+  Napi::Env env = info.Env();
+  Object stats = Object::New(env);
+  stats["pending"] = Number::New(env, pendingMsgCount.load());
+  stats["pendingBytes"] = Number::New(env, pendingMsgBytes.load());
+  stats["dropped"] = Number::New(env, droppedMsgs.load());
+  stats["highWaterMark"] = Number::New(env, pendingMsgHighWater.load());
+  stats["highWaterBytes"] = Number::New(env, pendingBytesHighWater.load());
+  stats["slotHits"] = Number::New(env, pendingMsgs.ringPushes());
+  stats["slotMisses"] = Number::New(env, pendingMsgs.spills());
+  stats["capsPoolHits"] = Number::New(env, hackedCapsPool.hits);
+  stats["capsPoolMisses"] = Number::New(env, hackedCapsPool.misses);
+  stats["replyPoolHits"] = Number::New(env, replyPool.hits);
+  stats["replyPoolMisses"] = Number::New(env, replyPool.misses);
+  return stats;
+}
+
+int32_t ClientNative::postMsg(Napi::Env env, const Napi::Value& jsname,
+                              const Napi::Value& jsmsg,
+                              const Napi::Value& jstype, bool isCaps) {
+  std::string name = jsname.As<String>().Utf8Value();
+  shared_ptr<Caps> msg;
+  uint32_t msgtype = FLORA_MSGTYPE_INSTANT;
+  if (jstype.IsNumber()) {
+    msgtype = jstype.As<Number>().Uint32Value();
+  }
+  uint32_t flags = postFlags(name, msgtype);
+
+  // msg is Caps object
+  if (isCaps) {
+    if (!genCapsByJSCaps(env, jsmsg, msg)) {
+      return ERROR_INVALID_PARAM;
+    }
+  } else {
+    if (jsmsg.IsArray() && !genCapsByJSArray(env, jsmsg, msg, flags)) {
+      return ERROR_INVALID_PARAM;
+    }
+  }
+  return postCaps(name, msg, msgtype, flags);
+}
+
+// memfds only for instant msgs of names some receiver acked, other
+// receivers may not decode them. memfds of persist msgs closed before
+// later subscribers get them
+uint32_t ClientNative::postFlags(const std::string& name, uint32_t msgtype) {
+  if (!(encodeFlags & CAPS_ENCODE_SHARED_MEMORY))
+    return encodeFlags;
+  if (msgtype != FLORA_MSGTYPE_INSTANT ||
+      !shmAccepted(dispatcherUri + '\0' + name))
+    return encodeFlags & ~CAPS_ENCODE_SHARED_MEMORY;
+  return encodeFlags;
+}
+
+// instant msgs not fit in bufsize posted as fragments, if agent option
+// fragment set. persist msgs could not be fragmented, dispatcher keeps
+// last one only
+int32_t ClientNative::postCaps(const std::string& name, shared_ptr<Caps>& msg,
+                               uint32_t msgtype, uint32_t flags) {
+  // memfds of msg kept until receivers acked, acks may come before post
+  // returned
+  if (flags & CAPS_ENCODE_SHARED_MEMORY) {
+    shmPosted(msg, dispatcherUri + '\0' + name);
+    int32_t r = postCaps(name, msg, msgtype);
+    // received by none, receivers not waited
+    if (r != FLORA_CLI_SUCCESS)
+      shmPosted(msg, std::string());
+    return r;
+  }
+  if (msgtype == FLORA_MSGTYPE_INSTANT && msg.get() &&
+      bufsize > FRAGMENT_OVERHEAD + name.length()) {
+    uint32_t fragSize = bufsize - FRAGMENT_OVERHEAD - name.length();
+    std::vector<shared_ptr<Caps>> frags;
+    if (capsBinarySize(msg) > fragSize &&
+        splitMsg(msg, fragSize, fragmentBuffers, frags)) {
+      for (size_t i = 0; i < frags.size(); ++i) {
+        if (connection->agent.post(name.c_str(), frags[i], msgtype) ==
+            FLORA_CLI_SUCCESS)
+          continue;
+        // receivers drop fragments of the msg received so far
+        if (i > 0) {
+          shared_ptr<Caps> abort = abortFragment(frags[0]);
+          if (abort)
+            connection->agent.post(name.c_str(), abort, msgtype);
+        }
+        return ERROR_NOT_CONNECTED;
+      }
+      return FLORA_CLI_SUCCESS;
+    }
+  }
+  if (connection->agent.post(name.c_str(), msg, msgtype) != FLORA_CLI_SUCCESS) {
+    return ERROR_NOT_CONNECTED;
+  }
+  if (msgtype == FLORA_MSGTYPE_PERSIST)
+    cachePersistMsg(dispatcherUri, name.c_str(), msg);
+  return FLORA_CLI_SUCCESS;
+}
+
+// nativePeek(name)
+// returns hackedCaps of last persist msg, undefined if never seen
+Value ClientNative::peek(const CallbackInfo& info) {
+  Napi::Env env = info.Env();
+  if (!info[0].IsString())
     return env.Undefined();
+  shared_ptr<Caps> msg;
+  if (!peekPersistMsg(dispatcherUri, info[0].As<String>().Utf8Value(), msg))
+    return env.Undefined();
+  return Napi::Value(env, genHackedCaps(env, msg, nullptr, msg));
+}
+
+Value ClientNative::post(const CallbackInfo& info) {
+  Napi::Env env = info.Env();
+  if (!(status & NATIVE_STATUS_CONFIGURED))
+    return Number::New(env, ERROR_INVALID_URI);
+  return Number::New(env, postMsg(env, info[0], info[1], info[2],
+                                  info[3].As<Boolean>().Value()));
+}
+
+// nativePostChunk(stream, seq, data, isCaps)
+// chunk of StreamReply posted as [ seq, data ], data may be Caps object
+Value ClientNative::postChunk(const CallbackInfo& info) {
+  Napi::Env env = info.Env();
+  if (!(status & NATIVE_STATUS_CONFIGURED))
+    return Number::New(env, ERROR_INVALID_URI);
+  if (!info[0].IsString() || !info[1].IsNumber())
+    return Number::New(env, ERROR_INVALID_PARAM);
+  std::string stream = info[0].As<String>().Utf8Value();
+  uint32_t flags = postFlags(stream, FLORA_MSGTYPE_INSTANT);
+  shared_ptr<Caps> data;
+  if (info[3].As<Boolean>().Value()) {
+    if (!genCapsByJSCaps(env, info[2], data))
+      return Number::New(env, ERROR_INVALID_PARAM);
+  } else if (info[2].IsArray() &&
+             !genCapsByJSArray(env, info[2], data, flags)) {
+    return Number::New(env, ERROR_INVALID_PARAM);
+  }
+  shared_ptr<Caps> msg = Caps::new_instance();
+  msg->write(info[1].As<Number>().Int32Value());
+  if (data.get())
+    msg->write(data);
+  else
+    msg->write();
+  return Number::New(env,
+                     postCaps(stream, msg, FLORA_MSGTYPE_INSTANT, flags));
+}
+
+// nativePostBatch([ [ name, msg, type ], ... ], isCaps[])
+// msg of item i taken as Caps only if isCaps[i] is true, checked by
+// instanceof Caps in js.
+// returns array of result codes
+Value ClientNative::postBatch(const CallbackInfo& info) {
+  Napi::Env env = info.Env();
+  if (!(status & NATIVE_STATUS_CONFIGURED))
+    return Number::New(env, ERROR_INVALID_URI);
+  if (!info[0].IsArray() || !info[1].IsArray())
+    return Number::New(env, ERROR_INVALID_PARAM);
+  Array batch = info[0].As<Array>();
+  Array capsFlags = info[1].As<Array>();
+  uint32_t len = batch.Length();
+  Array results = Array::New(env, len);
+  for (uint32_t i = 0; i < len; ++i) {
+    Napi::Value item = batch.Get(i);
+    int32_t r = ERROR_INVALID_PARAM;
+    if (item.IsArray()) {
+      Array args = item.As<Array>();
+      Napi::Value name = args.Get((uint32_t)0);
+      Napi::Value msg = args.Get(1);
+      Napi::Value type = args.Get(2);
+      Napi::Value flag = capsFlags.Get(i);
+      bool isCaps = flag.IsBoolean() && flag.As<Boolean>().Value();
+      if (name.IsString() && (msg.IsArray() || msg.IsUndefined() ||
+                              msg.IsNull() || isCaps) &&
+          (type.IsUndefined() ||
+           (type.IsNumber() &&
+            type.As<Number>().Uint32Value() < FLORA_NUMBER_OF_MSGTYPE))) {
+        r = postMsg(env, name, msg, type, isCaps);
+      }
+    }
+    results.Set(i, Number::New(env, r));
+  }
+  return results;
+}
+
+Value ClientNative::call(const CallbackInfo& info) {
+  Napi::Env env = info.Env();
+  if (!(status & NATIVE_STATUS_CONFIGURED))
+    return Number::New(env, ERROR_INVALID_URI);
+  // responses need async handles, connection may be started by other thread
+  if (!(status & NATIVE_STATUS_STARTED))
+    return Number::New(env, ERROR_NOT_CONNECTED);
+  // assert(info.Length() == 3);
+  shared_ptr<Caps> msg;
+  // msg is Caps object
+  if (info[4].As<Boolean>().Value()) {
+    if (!genCapsByJSCaps(env, info[1], msg)) {
+      return Number::New(env, ERROR_INVALID_PARAM);
+    }
+  } else {
+    // callees never acked memfds, params copied
+    if (info[1].IsArray() &&
+        !genCapsByJSArray(env, info[1], msg,
+                          encodeFlags & ~CAPS_ENCODE_SHARED_MEMORY)) {
+      return Number::New(env, ERROR_INVALID_PARAM);
+    }
+  }
+  uint32_t timeout = 0;
+  if (info[5].IsNumber()) {
+    timeout = info[5].As<Number>().Uint32Value();
+  }
+  napi_ref cbr;
+  auto nr = napi_create_reference(env, info[3], 1, &cbr);
+  if (nr != napi_ok) {
+    return Number::New(env, ERROR_JVM_API_FAILED);
+  }
+  std::string name = info[0].As<String>().Utf8Value();
+  std::string target = info[2].As<String>().Utf8Value();
+  // cbr released when callback invoked, or agent closed
+  uint32_t id =
+      trackCall(cbr, name, target, timeout, parsePriority(info[6]), nullptr);
+  shared_ptr<ClientAnchor> anchor = this->anchor;
+  int32_t r = connection->agent.call(
+      name.c_str(), msg, target.c_str(),
+      [anchor, env, id](int32_t rescode, Response& resp) {
+        std::lock_guard<std::mutex> locker(anchor->mutex);
+        if (anchor->client)
+          anchor->client->respCallback(env, id, rescode, resp);
+      },
+      timeout);
+  // callback never invoked if call failed
+  if (r != FLORA_CLI_SUCCESS) {
+    InflightCall failed;
+    if (untrackCall(id, failed))
+      napi_delete_reference(env, cbr);
+    return Number::New(env, r);
+  }
+  // id for nativeCancelCall
+  return Number::New(env, id);
+}
+
+// nativeCallMany(name, msg, targets, cb, isCaps, timeout, priority)
+// msg serialized once, cb invoked once with results of all targets
+Value ClientNative::callMany(const CallbackInfo& info) {
+  Napi::Env env = info.Env();
+  if (!(status & NATIVE_STATUS_CONFIGURED))
+    return Number::New(env, ERROR_INVALID_URI);
+  if (!(status & NATIVE_STATUS_STARTED))
+    return Number::New(env, ERROR_NOT_CONNECTED);
+  shared_ptr<Caps> msg;
+  // msg is Caps object
+  if (info[4].As<Boolean>().Value()) {
+    if (!genCapsByJSCaps(env, info[1], msg)) {
+      return Number::New(env, ERROR_INVALID_PARAM);
+    }
+  } else {
+    // callees never acked memfds, params copied
+    if (info[1].IsArray() &&
+        !genCapsByJSArray(env, info[1], msg,
+                          encodeFlags & ~CAPS_ENCODE_SHARED_MEMORY)) {
+      return Number::New(env, ERROR_INVALID_PARAM);
+    }
+  }
+  if (!info[2].IsArray())
+    return Number::New(env, ERROR_INVALID_PARAM);
+  Array jstargets = info[2].As<Array>();
+  uint32_t count = jstargets.Length();
+  if (count == 0)
+    return Number::New(env, ERROR_INVALID_PARAM);
+  std::vector<std::string> targets(count);
+  uint32_t i;
+  for (i = 0; i < count; ++i) {
+    Napi::Value v = jstargets.Get(i);
+    if (!v.IsString())
+      return Number::New(env, ERROR_INVALID_PARAM);
+    targets[i] = v.As<String>().Utf8Value();
+  }
+  uint32_t timeout = 0;
+  if (info[5].IsNumber()) {
+    timeout = info[5].As<Number>().Uint32Value();
+  }
+  napi_ref cbr;
+  if (napi_create_reference(env, info[3], 1, &cbr) != napi_ok) {
+    return Number::New(env, ERROR_JVM_API_FAILED);
+  }
+  shared_ptr<CallGroup> group = make_shared<CallGroup>();
+  group->remaining = count;
+  // targets not responded when agent closed keep ERROR_NOT_CONNECTED
+  group->rescodes.resize(count, ERROR_NOT_CONNECTED);
+  group->responses.resize(count);
+  std::string name = info[0].As<String>().Utf8Value();
+  group->callId = trackCall(cbr, name, std::string(), timeout,
+                            parsePriority(info[6]), group);
+  shared_ptr<ClientAnchor> anchor = this->anchor;
+  for (i = 0; i < count; ++i) {
+    int32_t r = connection->agent.call(
+        name.c_str(), msg, targets[i].c_str(),
+        [anchor, env, group, i](int32_t rescode, Response& resp) {
+          shared_ptr<CallGroup> g = group;
+          std::lock_guard<std::mutex> locker(anchor->mutex);
+          if (anchor->client)
+            anchor->client->groupRespCallback(env, g, i, rescode, &resp);
+        },
+        timeout);
+    // callback never invoked if call failed
+    if (r != FLORA_CLI_SUCCESS)
+      groupRespCallback(env, group, i, r, nullptr);
+  }
+  // id for nativeCancelCall
+  return Number::New(env, group->callId);
+}
+
+// nativeCancelCall(id)
+// returns true if call was pending, its callback will never be invoked.
+// flora has no cancel message, callee is not notified
+Value ClientNative::cancelCall(const CallbackInfo& info) {
+  Napi::Env env = info.Env();
+  if (!info[0].IsNumber())
+    return Boolean::New(env, false);
+  InflightCall call;
+  if (!untrackCall(info[0].As<Number>().Uint32Value(), call))
+    return Boolean::New(env, false);
+  napi_delete_reference(env, call.cbr);
+  return Boolean::New(env, true);
+}
+
+static void freePreparedMsg(napi_env, void* data, void* arg) {
+  delete reinterpret_cast<PreparedMsg*>(data);
+}
+
+static PreparedMsg* getPreparedMsg(napi_env env, const Napi::Value& v) {
+  PreparedMsg* prepared = nullptr;
+  if (!v.IsExternal())
+    return nullptr;
+  if (napi_get_value_external(env, v, (void**)&prepared) != napi_ok)
+    return nullptr;
+  return prepared;
+}
+
+// nativePrepare(name, msg, isCaps)
+Value ClientNative::prepare(const CallbackInfo& info) {
+  Napi::Env env = info.Env();
+  if (!info[0].IsString())
+    return Number::New(env, ERROR_INVALID_PARAM);
+  PreparedMsg* prepared = new PreparedMsg();
+  prepared->name = info[0].As<String>().Utf8Value();
+  bool r = true;
+  if (info[2].As<Boolean>().Value()) {
+    r = genCapsByJSCaps(env, info[1], prepared->msg);
+  } else if (info[1].IsArray()) {
+    // memfd closed by sender after SHM_KEEP_MS, not for prepared msg
+    r = genCapsByJSArray(env, info[1], prepared->msg,
+                         encodeFlags & ~CAPS_ENCODE_SHARED_MEMORY);
+  }
+  napi_value jsobj;
+  if (!r || napi_create_external(env, prepared, freePreparedMsg, nullptr,
+                                 &jsobj) != napi_ok) {
+    delete prepared;
+    return Number::New(env, ERROR_INVALID_PARAM);
+  }
+  return Napi::Value(env, jsobj);
+}
+
+// nativePostPrepared(prepared, type)
+Value ClientNative::postPrepared(const CallbackInfo& info) {
+  Napi::Env env = info.Env();
+  if (!(status & NATIVE_STATUS_CONFIGURED))
+    return Number::New(env, ERROR_INVALID_URI);
+  PreparedMsg* prepared = getPreparedMsg(env, info[0]);
+  if (prepared == nullptr)
+    return Number::New(env, ERROR_INVALID_PARAM);
+  if (prepared->dirty) {
+    prepared->msg = Caps::new_instance();
+    for (auto it = prepared->members.begin(); it != prepared->members.end();
+         ++it) {
+      writeCapsMember(prepared->msg, *it);
+    }
+    prepared->dirty = false;
+  }
+  uint32_t msgtype = FLORA_MSGTYPE_INSTANT;
+  if (info[1].IsNumber()) {
+    msgtype = info[1].As<Number>().Uint32Value();
+  }
+  return Number::New(env, postCaps(prepared->name, prepared->msg, msgtype));
+}
+
+// nativeSetPrepared(prepared, index, value)
+// index could be count of members for appending
+Value ClientNative::setPrepared(const CallbackInfo& info) {
+  Napi::Env env = info.Env();
+  PreparedMsg* prepared = getPreparedMsg(env, info[0]);
+  if (prepared == nullptr || !info[1].IsNumber())
+    return Number::New(env, ERROR_INVALID_PARAM);
+  if (!prepared->membersRead) {
+    prepared->membersRead = true;
+    if (prepared->msg.get()) {
+      readCapsMembers(prepared->msg, prepared->members);
+      // msg will be replaced, take binaries out of it
+      for (auto it = prepared->members.begin(); it != prepared->members.end();
+           ++it) {
+        if (it->type == CAPS_MEMBER_TYPE_BINARY) {
+          it->str.assign(reinterpret_cast<const char*>(it->bin),
+                         it->binLength);
+          it->bin = nullptr;
+          it->binLength = 0;
+        }
+      }
+    }
+  }
+  uint32_t idx = info[1].As<Number>().Uint32Value();
+  if (idx > prepared->members.size())
+    return Number::New(env, ERROR_INVALID_PARAM);
+  CapsMember m;
+  // prepared msg posted many times, no memfd
+  if (!genCapsMemberByJS(env, info[2], m,
+                         encodeFlags & ~CAPS_ENCODE_SHARED_MEMORY))
+    return Number::New(env, ERROR_INVALID_PARAM);
+  if (idx == prepared->members.size())
+    prepared->members.push_back(std::move(m));
+  else
+    prepared->members[idx] = std::move(m);
+  prepared->dirty = true;
+  return Number::New(env, FLORA_CLI_SUCCESS);
+}
+
+Value ClientNative::genArray(const CallbackInfo& info) {
+  Napi::Env env = info.Env();
+  if (!info[0].IsExternal())
+    return env.Undefined();
+  HackedNativeCaps* hackedCaps = nullptr;
+  if (napi_get_value_external(env, info[0], (void**)&hackedCaps) != napi_ok ||
+      hackedCaps == nullptr) {
+    return env.Undefined();
+  }
+  if (hackedCaps->flat)
+    return genJSArrayByFlat(env, *hackedCaps->flat);
+  // msg may be decoded by more than one handler
+  if (hackedCaps->caps.get())
+    hackedCaps->caps->rewind();
+  Napi::Value r = genJSArrayByCaps(env, hackedCaps->caps, hackedCaps->storage,
+                                   hackedCaps->shm);
+  if (hackedCaps->caps.get())
+    hackedCaps->caps->rewind();
+  return r;
+}
+
+static uint32_t capsBinarySize(std::shared_ptr<Caps>& caps) {
+  if (caps.get() == nullptr)
+    return 0;
+  int32_t r = caps->serialize(nullptr, 0);
+  return r > 0 ? r : 0;
+}
+
+// bytes of msg accounted in maxPendingBytes, payload of members read in
+// place plus CAPS_MEMBER_COST each, msg not serialized.
+// flora thread, msg rewound before return
+#define CAPS_MEMBER_COST 4
+static uint32_t pendingMsgSize(std::shared_ptr<Caps>& caps) {
+  int32_t iv;
+  int64_t lv;
+  float fv;
+  double dv;
+  const char* sv;
+  const void* bv;
+  uint32_t blen;
+  std::shared_ptr<Caps> cv;
+  uint32_t bytes = 0;
+
+  if (caps.get() == nullptr)
+    return 0;
+  while (true) {
+    int32_t mtp = caps->next_type();
+    if (mtp == CAPS_ERR_EOO)
+      break;
+    bytes += CAPS_MEMBER_COST;
+    switch (mtp) {
+      case CAPS_MEMBER_TYPE_INTEGER:
+        caps->read(iv);
+        bytes += sizeof(iv);
+        break;
+      case CAPS_MEMBER_TYPE_LONG:
+        caps->read(lv);
+        bytes += sizeof(lv);
+        break;
+      case CAPS_MEMBER_TYPE_FLOAT:
+        caps->read(fv);
+        bytes += sizeof(fv);
+        break;
+      case CAPS_MEMBER_TYPE_DOUBLE:
+        caps->read(dv);
+        bytes += sizeof(dv);
+        break;
+      case CAPS_MEMBER_TYPE_STRING:
+        if (caps->read(sv) == CAPS_SUCCESS && sv)
+          bytes += strlen(sv);
+        break;
+      case CAPS_MEMBER_TYPE_BINARY:
+        if (caps->read(bv, blen) == CAPS_SUCCESS)
+          bytes += blen;
+        break;
+      case CAPS_MEMBER_TYPE_OBJECT:
+        if (caps->read(cv) == CAPS_SUCCESS)
+          bytes += pendingMsgSize(cv);
+        break;
+      default:
+        caps->read();
+        break;
+    }
   }
-  floraAgent.declare_method(name.c_str(),
-                            [this, env](const char* name, shared_ptr<Caps>& msg,
-                                        shared_ptr<Reply>& reply) {
-                              this->msgCallback(name, env, msg, 0xffffffff,
-                                                reply);
-                            });
-  return env.Undefined();
+  caps->rewind();
+  return bytes;
 }
 
-Value ClientNative::removeMethod(const CallbackInfo& info) {
-  Napi::Env env = info.Env();
-  if (!(status & NATIVE_STATUS_CONFIGURED))
-    return env.Undefined();
-  if (info.Length() < 1 || !info[0].IsString()) {
-    TypeError::New(env, "String excepted").ThrowAsJavaScriptException();
-    return env.Undefined();
+// returns false if msg dropped by overflow policy
+bool ClientNative::msgCallback(uint32_t topic, const char* name,
+                               Napi::Env env, std::shared_ptr<Caps>& msg,
+                               uint32_t type,
+                               shared_ptr<Reply> reply,
+                               shared_ptr<const SubscriptionHandlers> handlers,
+                               uint64_t handlerMask, uint64_t seq,
+                               uint32_t lane, bool withSender,
+                               bool ownsStorage,
+                               shared_ptr<ShmBinaries> shm) {
+  MsgCallbackInfo cbinfo(env);
+  initMsgCallbackInfo(cbinfo, topic, msg, type, std::move(handlers),
+                      handlerMask, seq, lane, withSender, ownsStorage,
+                      std::move(shm));
+  if (predecode) {
+    cbinfo.flat = make_shared<FlatMsg>();
+    if (!flattenCaps(msg, *cbinfo.flat))
+      cbinfo.flat.reset();
   }
-  std::string name = std::string(info[0].As<String>());
-  SubscriptionMap::iterator it = remoteMethods.find(name);
-  if (it != remoteMethods.end()) {
-    it->second.Unref();
-    remoteMethods.erase(it);
+  if (type >= FLORA_NUMBER_OF_MSGTYPE) {
+    cbinfo.reply = reply;
+  } else if (maxPendingBytes > 0 && !cbinfo.pinned) {
+    cbinfo.bytes = strlen(name) + pendingMsgSize(msg);
   }
-  floraAgent.remove_method(name.c_str());
-  return env.Undefined();
+  if (!enqueueMsg(cbinfo))
+    return false;
+  uv_async_send(&msgAsync);
+  return true;
 }
 
-void ClientNative::close() {
-  if ((status & NATIVE_STATUS_CONFIGURED) && (status & NATIVE_STATUS_STARTED)) {
-    SubscriptionMap::iterator subit;
-
-    floraAgent.close();
-    uv_close((uv_handle_t*)&msgAsync, async_close_cb);
-    uv_close((uv_handle_t*)&respAsync, async_close_cb);
-    for (subit = subscriptions.begin(); subit != subscriptions.end(); ++subit) {
-      subit->second.Unref();
+void ClientNative::initMsgCallbackInfo(
+    MsgCallbackInfo& cbinfo, uint32_t topic, shared_ptr<Caps>& msg,
+    uint32_t type, shared_ptr<const SubscriptionHandlers> handlers,
+    uint64_t handlerMask, uint64_t seq, uint32_t lane, bool withSender,
+    bool ownsStorage, shared_ptr<ShmBinaries> shm) {
+  cbinfo.topic = topic;
+  cbinfo.msg = msg;
+  cbinfo.ownsStorage = ownsStorage;
+  cbinfo.msgtype = type;
+  cbinfo.handlers = std::move(handlers);
+  cbinfo.handlerMask = handlerMask;
+  cbinfo.seq = seq;
+  cbinfo.lane = lane;
+  cbinfo.pinned = type >= FLORA_NUMBER_OF_MSGTYPE ||
+                  (cbinfo.handlers && cbinfo.handlers->stream);
+  if (withSender) {
+    cbinfo.hasSender = true;
+    cbinfo.sender.type = MsgSender::connection_type();
+    if (cbinfo.sender.type == 0)
+      cbinfo.sender.pid = MsgSender::pid();
+    else {
+      cbinfo.sender.ipaddr = MsgSender::ipaddr();
+      cbinfo.sender.port = MsgSender::port();
     }
-    subscriptions.clear();
-    thisRef.Unref();
-    napi_async_destroy(thisEnv, asyncContext);
-    asyncContext = nullptr;
-    status &= (~NATIVE_STATUS_STARTED);
+    cbinfo.sender.name = MsgSender::name();
   }
+  cbinfo.shm = std::move(shm);
 }
 
-Value ClientNative::getSocket(const CallbackInfo& info) {
-  auto fd = floraAgent.get_socket();
-  if (fd < 0)
-    return info.Env().Undefined();
-  return Number::New(info.Env(), fd);
+// flora thread. memfds of msg mapped before queued, msg dropped if any
+// closed by sender already. memfds acked to sender once mapped, or not
+// wanted by handlers. msgs with large binaries copied acked too, sender
+// posts memfds to the name from then on
+bool ClientNative::mapShm(const char* name, shared_ptr<Caps>& msg,
+                          bool wanted, shared_ptr<ShmBinaries>& shm) {
+  // memfds of the sending process only, opened by /proc/<pid>/fd
+  if (!(encodeFlags & CAPS_ENCODE_SHARED_MEMORY) ||
+      MsgSender::connection_type() != 0)
+    return true;
+  uint32_t pid = MsgSender::pid();
+  ShmBinaries binaries;
+  std::vector<int64_t> inodes;
+  bool large = false;
+  bool mapped = true;
+  if (wanted)
+    mapped = mapShmBinaries(msg, pid, binaries, large);
+  else
+    listShmBinaries(msg, inodes, large);
+  if (!binaries.empty() || !inodes.empty() || large || !mapped) {
+    shared_ptr<Caps> ack = Caps::new_instance();
+    ack->write(name);
+    ack->write(shmReceiver);
+    // lost memfds not acked, this agent still accepts later ones
+    for (auto it = binaries.begin(); mapped && it != binaries.end(); ++it)
+      ack->write(it->first);
+    for (size_t i = 0; i < inodes.size(); ++i)
+      ack->write(inodes[i]);
+    connection->agent.post((SHM_ACK_PREFIX + std::to_string(pid)).c_str(),
+                           ack, FLORA_MSGTYPE_INSTANT);
+  }
+  if (!mapped) {
+    ++droppedMsgs;
+    return false;
+  }
+  if (!binaries.empty())
+    shm = make_shared<ShmBinaries>(std::move(binaries));
+  return true;
 }
 
-Value ClientNative::post(const CallbackInfo& info) {
-  Napi::Env env = info.Env();
-  if (!(status & NATIVE_STATUS_CONFIGURED))
-    return Number::New(env, ERROR_INVALID_URI);
-  std::string name = info[0].As<String>().Utf8Value();
-  shared_ptr<Caps> msg;
+// a single msg always accepted by an empty queue
+bool ClientNative::pendingMsgsOverLimit(uint32_t incomingBytes) {
+  uint32_t count = pendingMsgCount.load();
+  if (count == 0)
+    return false;
+  if (maxPendingMsgs > 0 && count >= maxPendingMsgs)
+    return true;
+  return maxPendingBytes > 0 &&
+         pendingMsgBytes.load() + incomingBytes > maxPendingBytes;
+}
 
-  // msg is Caps object
-  if (info[3].As<Boolean>().Value()) {
-    if (!genCapsByJSCaps(env, info[1], msg)) {
-      return Number::New(env, ERROR_INVALID_PARAM);
+// flora thread
+// returns true if js thread need to be waken up
+bool ClientNative::enqueueMsg(MsgCallbackInfo& cbinfo) {
+  if (cbinfo.pinned) {
+    return pendingMsgs.push(cbinfo.lane, std::move(cbinfo));
+  }
+  if (pendingMsgsOverLimit(cbinfo.bytes)) {
+    if (overflowPolicy == OVERFLOW_POLICY_DROP_NEWEST) {
+      ++droppedMsgs;
+      return false;
     }
-  } else {
-    if (info[1].IsArray() && !genCapsByJSArray(env, info[1], msg)) {
-      return Number::New(env, ERROR_INVALID_PARAM);
+    if (overflowPolicy == OVERFLOW_POLICY_BLOCK) {
+      unique_lock<mutex> locker(block_mutex);
+      producerBlocked = true;
+      block_cond.wait(locker, [this, &cbinfo]() {
+        return closing || !pendingMsgsOverLimit(cbinfo.bytes);
+      });
+      producerBlocked = false;
+      if (closing) {
+        ++droppedMsgs;
+        return false;
+      }
+    } else {
+      // OVERFLOW_POLICY_DROP_OLDEST
+      // method invocations and stream chunks passed over keep their place
+      // in queue
+      MsgCallbackInfo old;
+      auto isPinned = [](const MsgCallbackInfo& info) {
+        return info.pinned;
+      };
+      while (pendingMsgsOverLimit(cbinfo.bytes)) {
+        if (!pendingMsgs.evictLowest(old, isPinned))
+          break;
+        --pendingMsgCount;
+        pendingMsgBytes -= old.bytes;
+        ++droppedMsgs;
+      }
     }
   }
-  uint32_t msgtype = FLORA_MSGTYPE_INSTANT;
-  if (info[2].IsNumber()) {
-    msgtype = info[2].As<Number>().Uint32Value();
+  uint32_t count = ++pendingMsgCount;
+  uint32_t bytes = (pendingMsgBytes += cbinfo.bytes);
+  // flora thread is the only writer of high water marks
+  if (count > pendingMsgHighWater.load())
+    pendingMsgHighWater = count;
+  if (bytes > pendingBytesHighWater.load())
+    pendingBytesHighWater = bytes;
+  return pendingMsgs.push(cbinfo.lane, std::move(cbinfo));
+}
+
+// js thread
+bool ClientNative::popPendingMsg(MsgCallbackInfo& cbinfo) {
+  if (!pendingMsgs.pop(cbinfo))
+    return false;
+  if (cbinfo.pinned)
+    return true;
+  --pendingMsgCount;
+  pendingMsgBytes -= cbinfo.bytes;
+  if (producerBlocked) {
+    block_mutex.lock();
+    block_cond.notify_one();
+    block_mutex.unlock();
   }
-  if (floraAgent.post(name.c_str(), msg, msgtype) != FLORA_CLI_SUCCESS) {
-    return Number::New(env, ERROR_NOT_CONNECTED);
+  return true;
+}
+
+void ClientNative::respCallback(napi_env env, uint32_t callId,
+                                int32_t rescode, Response& response) {
+  InflightCall call;
+  if (!untrackCall(callId, call))
+    return;
+  RespCallbackInfo cbinfo;
+  cbinfo.env = env;
+  cbinfo.cbr = call.cbr;
+  cbinfo.rescode = rescode;
+  cbinfo.response = response;
+  cbinfo.lane = call.lane;
+  queueResponse(cbinfo);
+}
+
+void ClientNative::groupRespCallback(napi_env env,
+                                     shared_ptr<CallGroup>& group,
+                                     uint32_t idx, int32_t rescode,
+                                     Response* response) {
+  group->mutex.lock();
+  group->rescodes[idx] = rescode;
+  if (response)
+    group->responses[idx] = *response;
+  bool done = --group->remaining == 0;
+  group->mutex.unlock();
+  InflightCall call;
+  if (!done || !untrackCall(group->callId, call))
+    return;
+  RespCallbackInfo cbinfo;
+  cbinfo.env = env;
+  cbinfo.cbr = call.cbr;
+  cbinfo.rescode = FLORA_CLI_SUCCESS;
+  cbinfo.lane = call.lane;
+  cbinfo.group = group;
+  queueResponse(cbinfo);
+}
+
+void ClientNative::queueResponse(RespCallbackInfo& cbinfo) {
+  resp_mutex.lock();
+  bool wakeup = pendingResponses.push(cbinfo.lane, std::move(cbinfo));
+  resp_mutex.unlock();
+  if (wakeup)
+    uv_async_send(&respAsync);
+}
+
+uint32_t ClientNative::trackCall(napi_ref cbr, const std::string& name,
+                                 const std::string& target, uint32_t timeout,
+                                 uint32_t lane, shared_ptr<CallGroup> group) {
+  std::lock_guard<std::mutex> locker(calls_mutex);
+  uint32_t id = ++lastCallId;
+  InflightCall& call = inflightCalls[id];
+  call.cbr = cbr;
+  call.name = name;
+  call.target = target;
+  call.startTime = uv_hrtime();
+  call.timeout = timeout;
+  call.lane = lane;
+  call.group = std::move(group);
+  return id;
+}
+
+bool ClientNative::untrackCall(uint32_t id, InflightCall& call) {
+  std::lock_guard<std::mutex> locker(calls_mutex);
+  auto it = inflightCalls.find(id);
+  if (it == inflightCalls.end())
+    return false;
+  call = std::move(it->second);
+  inflightCalls.erase(it);
+  return true;
+}
+
+// flora closed, no more callbacks of calls.
+// callbacks of calls still pending queued with ERROR_NOT_CONNECTED
+void ClientNative::rejectPendingCalls() {
+  std::map<uint32_t, InflightCall> calls;
+  calls_mutex.lock();
+  calls.swap(inflightCalls);
+  calls_mutex.unlock();
+  resp_mutex.lock();
+  for (auto it = calls.begin(); it != calls.end(); ++it) {
+    RespCallbackInfo cbinfo;
+    cbinfo.env = thisEnv;
+    cbinfo.cbr = it->second.cbr;
+    cbinfo.rescode = it->second.group ? FLORA_CLI_SUCCESS : ERROR_NOT_CONNECTED;
+    cbinfo.group = it->second.group;
+    cbinfo.lane = it->second.lane;
+    pendingResponses.push(cbinfo.lane, std::move(cbinfo));
   }
-  return Number::New(env, FLORA_CLI_SUCCESS);
+  resp_mutex.unlock();
 }
 
-Value ClientNative::call(const CallbackInfo& info) {
+Value ClientNative::pendingCalls(const CallbackInfo& info) {
   Napi::Env env = info.Env();
-  if (!(status & NATIVE_STATUS_CONFIGURED))
-    return Number::New(env, ERROR_INVALID_URI);
-  // assert(info.Length() == 3);
-  shared_ptr<Caps> msg;
-  // msg is Caps object
-  if (info[4].As<Boolean>().Value()) {
-    if (!genCapsByJSCaps(env, info[1], msg)) {
-      return Number::New(env, ERROR_INVALID_PARAM);
-    }
-  } else {
-    if (info[1].IsArray() && !genCapsByJSArray(env, info[1], msg)) {
-      return Number::New(env, ERROR_INVALID_PARAM);
-    }
-  }
-  uint32_t timeout = 0;
-  if (info[5].IsNumber()) {
-    timeout = info[5].As<Number>().Uint32Value();
+  std::vector<InflightCall> calls;
+  calls_mutex.lock();
+  calls.reserve(inflightCalls.size());
+  for (auto it = inflightCalls.begin(); it != inflightCalls.end(); ++it) {
+    calls.push_back(it->second);
   }
-  napi_ref cbr;
-  auto nr = napi_create_reference(env, info[3], 1, &cbr);
-  if (nr != napi_ok) {
-    return Number::New(env, ERROR_JVM_API_FAILED);
+  calls_mutex.unlock();
+
+  uint64_t now = uv_hrtime();
+  uint64_t oldest = 0;
+  uint32_t overdue = 0;
+  Array jscalls = Array::New(env, calls.size());
+  for (uint32_t i = 0; i < calls.size(); ++i) {
+    InflightCall& call = calls[i];
+    // milliseconds
+    uint64_t age = (now - call.startTime) / 1000000;
+    Object jscall = Object::New(env);
+    jscall["name"] = String::New(env, call.name);
+    if (call.group)
+      jscall["targets"] = Number::New(env, call.group->rescodes.size());
+    else
+      jscall["target"] = String::New(env, call.target);
+    jscall["age"] = Number::New(env, age);
+    jscall["timeout"] = Number::New(env, call.timeout);
+    jscalls.Set(i, jscall);
+    if (age > oldest)
+      oldest = age;
+    if (call.timeout > 0 && age > call.timeout)
+      ++overdue;
   }
-  // TODO: if callback of flora.call never invokded, the FunctionReference will
-  // never Unref!!
-  int32_t r = floraAgent.call(info[0].As<String>().Utf8Value().c_str(), msg,
-                              info[2].As<String>().Utf8Value().c_str(),
-                              [this, env, cbr](int32_t rescode, Response& resp) {
-                                this->respCallback(env, cbr, rescode, resp);
-                              },
-                              timeout);
-  return Number::New(env, r);
+  Object stats = Object::New(env);
+  stats["count"] = Number::New(env, calls.size());
+  stats["overdue"] = Number::New(env, overdue);
+  stats["oldestAge"] = Number::New(env, oldest);
+  stats["calls"] = jscalls;
+  return stats;
 }
 
-Value ClientNative::genArray(const CallbackInfo& info) {
-  Napi::Env env = info.Env();
-  if (!info[0].IsExternal())
-    return env.Undefined();
-  HackedNativeCaps* hackedCaps = nullptr;
-  if (napi_get_value_external(env, info[0], (void**)&hackedCaps) != napi_ok ||
-      hackedCaps == nullptr) {
+void ClientNative::refDown() {
+  --asyncHandleCount;
+  // closed by env cleanup, agents still refer to this
+  if (asyncHandleCount == 0 && attachCount == 0)
+    delete this;
+}
+
+#ifdef NAPI_BINARY_SUPPORTED
+static void freeBorrowedCaps(napi_env env, void* data, void* hint) {
+  delete reinterpret_cast<shared_ptr<Caps>*>(hint);
+}
+
+// Buffer borrow binary member storage of owner, owner kept alive until
+// Buffer finalized. shared by all readers of the msg, treated as read only
+static Napi::Value genBorrowedBuffer(Napi::Env& env, shared_ptr<Caps>& owner,
+                                     const void* data, uint32_t length) {
+  if (length == 0)
+    return Buffer<uint8_t>::New(env, 0);
+  napi_value res;
+  shared_ptr<Caps>* holder = new shared_ptr<Caps>(owner);
+  if (napi_create_external_buffer(env, length, const_cast<void*>(data),
+                                  freeBorrowedCaps, holder,
+                                  &res) != napi_ok) {
+    delete holder;
     return env.Undefined();
   }
-  return genJSArrayByCaps(env, hackedCaps->caps);
-}
-
-void ClientNative::msgCallback(const char* name, Napi::Env env,
-                               std::shared_ptr<Caps>& msg, uint32_t type,
-                               shared_ptr<Reply> reply) {
-  unique_lock<mutex> locker(cb_mutex);
-  pendingMsgs.emplace_back(env);
-  std::list<MsgCallbackInfo>::iterator it = --pendingMsgs.end();
-  it->msgName = name;
-  it->msg = msg;
-  it->msgtype = type;
-  it->sender.type = MsgSender::connection_type();
-  if (it->sender.type == 0)
-    it->sender.pid = MsgSender::pid();
-  else {
-    it->sender.ipaddr = MsgSender::ipaddr();
-    it->sender.port = MsgSender::port();
-  }
-  it->sender.name = MsgSender::name();
-  if (type >= FLORA_NUMBER_OF_MSGTYPE) {
-    (*it).reply = reply;
-  }
-  uv_async_send(&msgAsync);
+  return Napi::Value(env, res);
 }
 
-void ClientNative::respCallback(napi_env env, napi_ref cbr, int32_t rescode,
-                                Response& response) {
-  cb_mutex.lock();
-  pendingResponses.emplace_back();
-  list<RespCallbackInfo>::iterator it = --pendingResponses.end();
-  (*it).env = env;
-  (*it).cbr = cbr;
-  (*it).rescode = rescode;
-  (*it).response = response;
-  cb_mutex.unlock();
-  uv_async_send(&respAsync);
+// binary member borrowed if storage is the msg owning it, copied otherwise.
+// msgs received from flora may point to its receive buffer
+static Napi::Value genBinaryBuffer(Napi::Env& env, shared_ptr<Caps>& storage,
+                                   const void* data, uint32_t length) {
+  if (storage)
+    return genBorrowedBuffer(env, storage, data, length);
+  return Buffer<uint8_t>::Copy(env, reinterpret_cast<const uint8_t*>(data),
+                               length);
 }
 
-void ClientNative::refDown() {
-  --asyncHandleCount;
-  if (asyncHandleCount == 0)
-    delete this;
+static Napi::Value genJSBufferByCaps(Napi::Env& env,
+                                     std::shared_ptr<Caps>& msg,
+                                     std::shared_ptr<Caps>& storage) {
+  const void* data;
+  uint32_t length;
+  if (msg->read(data, length) != CAPS_SUCCESS)
+    return env.Undefined();
+  return genBinaryBuffer(env, storage, data, length);
+}
+
+static void freeShmBuffer(napi_env env, void* data, void* hint) {
+  delete reinterpret_cast<shared_ptr<ShmBinary>*>(hint);
+}
+
+// Buffer on memfd mapping of binary member posted by shared memory,
+// mapped on flora thread when msg received
+static Napi::Value genJSBufferByShm(Napi::Env& env, shared_ptr<Caps>& desc,
+                                    const shared_ptr<ShmBinaries>& shm) {
+  auto it = shm->find(shmBinaryInode(desc));
+  if (it == shm->end())
+    return env.Undefined();
+  shared_ptr<ShmBinary>* binary = new shared_ptr<ShmBinary>(it->second);
+  napi_value res;
+  if (napi_create_external_buffer(env, (*binary)->length, (*binary)->data,
+                                  freeShmBuffer, binary, &res) != napi_ok) {
+    delete binary;
+    return env.Undefined();
+  }
+  return Napi::Value(env, res);
 }
+#endif
 
+// storage is top level msg owning binaries of msg, null if not owned.
+// shared memory descriptors decoded only if shm not null
 static Napi::Value genJSArrayByCaps(Napi::Env& env,
-                                    std::shared_ptr<Caps>& msg) {
+                                    std::shared_ptr<Caps>& msg,
+                                    std::shared_ptr<Caps>& storage,
+                                    const shared_ptr<ShmBinaries>& shm) {
   Array ret = Array::New(env);
   int32_t iv;
   int64_t lv;
@@ -485,14 +2197,20 @@ static Napi::Value genJSArrayByCaps(Napi::Env& env,
         msg->read_string(sbv);
         ret[idx++] = String::New(env, sbv);
         break;
-      // iotjs not support ArrayBuffer
-      // case CAPS_MEMBER_TYPE_BINARY:
-      //   msg->read_binary(sbv);
-      //   ret[idx++] = ArrayBuffer::New(env, (void*)sbv.data(), sbv.length());
-      //   break;
+#ifdef NAPI_BINARY_SUPPORTED
+      case CAPS_MEMBER_TYPE_BINARY:
+        ret[idx++] = genJSBufferByCaps(env, msg, storage);
+        break;
+#endif
       case CAPS_MEMBER_TYPE_OBJECT:
         msg->read(cv);
-        ret[idx++] = genJSArrayByCaps(env, cv);
+#ifdef NAPI_BINARY_SUPPORTED
+        if (shm && isShmBinary(cv)) {
+          ret[idx++] = genJSBufferByShm(env, cv, shm);
+          break;
+        }
+#endif
+        ret[idx++] = genJSArrayByCaps(env, cv, storage, shm);
         break;
       case CAPS_MEMBER_TYPE_VOID:
         msg->read();
@@ -503,8 +2221,246 @@ static Napi::Value genJSArrayByCaps(Napi::Env& env,
   return ret;
 }
 
+#ifdef NAPI_BINARY_SUPPORTED
+static void writeBinary(shared_ptr<Caps>& caps, const void* data,
+                        size_t length, uint32_t flags) {
+  if ((flags & CAPS_ENCODE_SHARED_MEMORY) && length >= SHM_MIN_SIZE &&
+      writeShmBinary(caps, data, length))
+    return;
+  caps->write(data, length);
+}
+
+// ArrayBuffer and TypedArray (Buffer included) as caps binary member
+static bool writeJSBinary(napi_env env, napi_value v, shared_ptr<Caps>& caps,
+                          uint32_t flags) {
+  bool is;
+  void* data = nullptr;
+  size_t length = 0;
+  napi_is_arraybuffer(env, v, &is);
+  if (is) {
+    napi_get_arraybuffer_info(env, v, &data, &length);
+    writeBinary(caps, data, length, flags);
+    return true;
+  }
+  napi_is_typedarray(env, v, &is);
+  if (is) {
+    napi_typedarray_type type;
+    size_t count;
+    uint32_t elemSize;
+    napi_get_typedarray_info(env, v, &type, &count, &data, nullptr, nullptr);
+    switch (type) {
+      case napi_int8_array:
+      case napi_uint8_array:
+      case napi_uint8_clamped_array:
+        elemSize = 1;
+        break;
+      case napi_int16_array:
+      case napi_uint16_array:
+        elemSize = 2;
+        break;
+      case napi_int32_array:
+      case napi_uint32_array:
+      case napi_float32_array:
+        elemSize = 4;
+        break;
+      case napi_float64_array:
+        elemSize = 8;
+        break;
+      default:
+        return false;
+    }
+    // data points to first element of the view
+    writeBinary(caps, data, count * elemSize, flags);
+    return true;
+  }
+  return false;
+}
+#endif
+
+// binary members point to storage of msg, strings too if borrowString
+static void readCapsMember(shared_ptr<Caps>& msg, CapsMember& m,
+                           bool borrowString) {
+  int32_t mtp = msg->next_type();
+  m.type = mtp;
+  switch (mtp) {
+    case CAPS_MEMBER_TYPE_INTEGER:
+      msg->read(m.num.iv);
+      break;
+    case CAPS_MEMBER_TYPE_LONG:
+      msg->read(m.num.lv);
+      break;
+    case CAPS_MEMBER_TYPE_FLOAT:
+      msg->read(m.num.fv);
+      break;
+    case CAPS_MEMBER_TYPE_DOUBLE:
+      msg->read(m.num.dv);
+      break;
+    case CAPS_MEMBER_TYPE_STRING:
+      if (borrowString)
+        msg->read(m.cstr);
+      else
+        msg->read_string(m.str);
+      break;
+    case CAPS_MEMBER_TYPE_BINARY:
+      msg->read(m.bin, m.binLength);
+      break;
+    case CAPS_MEMBER_TYPE_OBJECT:
+      msg->read(m.obj);
+      break;
+    default:
+      // CAPS_MEMBER_TYPE_VOID and members not supported
+      msg->read();
+      m.type = CAPS_MEMBER_TYPE_VOID;
+      break;
+  }
+}
+
+static void readCapsMembers(shared_ptr<Caps>& msg,
+                            std::vector<CapsMember>& members) {
+  msg->rewind();
+  while (msg->next_type() != CAPS_ERR_EOO) {
+    members.emplace_back();
+    readCapsMember(msg, members.back(), false);
+  }
+  msg->rewind();
+}
+
+// format 'lazy', members read until count of them read or all read.
+// read position of msg shared with other handlers, so members read
+// before are skipped again from start. read ahead doubles, indexing
+// members in order is not quadratic
+static void readLazyMembers(HackedNativeCaps* hackedCaps, uint32_t count) {
+  shared_ptr<Caps>& msg = hackedCaps->caps;
+  std::vector<CapsMember>& members = hackedCaps->members;
+  if (hackedCaps->membersEnd || members.size() >= count)
+    return;
+  if (msg.get() == nullptr) {
+    hackedCaps->membersEnd = true;
+    return;
+  }
+  if (count < members.size() * 2)
+    count = members.size() * 2;
+  msg->rewind();
+  CapsMember skipped;
+  size_t i;
+  for (i = 0; i < members.size(); ++i)
+    readCapsMember(msg, skipped, true);
+  while (members.size() < count) {
+    if (msg->next_type() == CAPS_ERR_EOO) {
+      hackedCaps->membersEnd = true;
+      break;
+    }
+    members.emplace_back();
+    readCapsMember(msg, members.back(), true);
+  }
+  msg->rewind();
+}
+
+static HackedNativeCaps* getLazyCaps(const CallbackInfo& info) {
+  HackedNativeCaps* hackedCaps = nullptr;
+  if (!info[0].IsExternal())
+    return nullptr;
+  if (napi_get_value_external(info.Env(), info[0], (void**)&hackedCaps) !=
+          napi_ok ||
+      hackedCaps == nullptr) {
+    return nullptr;
+  }
+  return hackedCaps;
+}
+
+static napi_value genHackedCaps(napi_env env, shared_ptr<Caps> msg,
+                                shared_ptr<FlatMsg> flat,
+                                shared_ptr<Caps> storage,
+                                shared_ptr<ShmBinaries> shm);
+
+// lazyLength(hackedCaps)
+static Napi::Value lazyLength(const CallbackInfo& info) {
+  HackedNativeCaps* hackedCaps = getLazyCaps(info);
+  if (hackedCaps == nullptr)
+    return info.Env().Undefined();
+  readLazyMembers(hackedCaps, UINT32_MAX);
+  return Number::New(info.Env(), hackedCaps->members.size());
+}
+
+// lazyGet(hackedCaps, index, wrap)
+// object members returned as wrap(hackedCaps of member)
+static Napi::Value lazyGet(const CallbackInfo& info) {
+  Napi::Env env = info.Env();
+  HackedNativeCaps* hackedCaps = getLazyCaps(info);
+  if (hackedCaps == nullptr || !info[1].IsNumber())
+    return env.Undefined();
+  uint32_t idx = info[1].As<Number>().Uint32Value();
+  if (idx < UINT32_MAX)
+    readLazyMembers(hackedCaps, idx + 1);
+  if (idx >= hackedCaps->members.size())
+    return env.Undefined();
+  CapsMember& m = hackedCaps->members[idx];
+  switch (m.type) {
+    case CAPS_MEMBER_TYPE_INTEGER:
+      return Number::New(env, m.num.iv);
+    case CAPS_MEMBER_TYPE_LONG:
+      return Number::New(env, m.num.lv);
+    case CAPS_MEMBER_TYPE_FLOAT:
+      return Number::New(env, m.num.fv);
+    case CAPS_MEMBER_TYPE_DOUBLE:
+      return Number::New(env, m.num.dv);
+    case CAPS_MEMBER_TYPE_STRING:
+      return String::New(env, m.cstr ? m.cstr : "");
+#ifdef NAPI_BINARY_SUPPORTED
+    case CAPS_MEMBER_TYPE_BINARY:
+      return genBinaryBuffer(env, hackedCaps->storage, m.bin, m.binLength);
+#endif
+    case CAPS_MEMBER_TYPE_OBJECT:
+#ifdef NAPI_BINARY_SUPPORTED
+      if (hackedCaps->shm && isShmBinary(m.obj))
+        return genJSBufferByShm(env, m.obj, hackedCaps->shm);
+#endif
+      if (info[2].IsFunction()) {
+        return info[2].As<Function>().Call(
+            { genHackedCaps(env, m.obj, nullptr, hackedCaps->storage,
+                            hackedCaps->shm) });
+      }
+      return genJSArrayByCaps(env, m.obj, hackedCaps->storage,
+                              hackedCaps->shm);
+  }
+  return env.Undefined();
+}
+
+// integral numbers written as int32/int64, 4/8 bytes less than double
+// and no float conversion for receiver.
+// -0, NaN, Infinity and integers beyond 2^53 stay double
+#define MAX_SAFE_INTEGER 9007199254740991.0
+static int32_t numberCapsType(double d, uint32_t flags) {
+  if (flags & CAPS_ENCODE_ALWAYS_DOUBLE)
+    return CAPS_MEMBER_TYPE_DOUBLE;
+  if (d >= INT32_MIN && d <= INT32_MAX) {
+    int32_t iv = static_cast<int32_t>(d);
+    if (iv == d && !(iv == 0 && std::signbit(d)))
+      return CAPS_MEMBER_TYPE_INTEGER;
+  } else if (d >= -MAX_SAFE_INTEGER && d <= MAX_SAFE_INTEGER) {
+    int64_t lv = static_cast<int64_t>(d);
+    if (lv == d)
+      return CAPS_MEMBER_TYPE_LONG;
+  }
+  return CAPS_MEMBER_TYPE_DOUBLE;
+}
+
+static void writeJSNumber(double d, shared_ptr<Caps>& caps, uint32_t flags) {
+  switch (numberCapsType(d, flags)) {
+    case CAPS_MEMBER_TYPE_INTEGER:
+      caps->write(static_cast<int32_t>(d));
+      break;
+    case CAPS_MEMBER_TYPE_LONG:
+      caps->write(static_cast<int64_t>(d));
+      break;
+    default:
+      caps->write(d);
+      break;
+  }
+}
+
 static bool genCapsByJSArray(napi_env env, napi_value jsmsg,
-                             shared_ptr<Caps>& caps) {
+                             shared_ptr<Caps>& caps, uint32_t flags) {
   caps = Caps::new_instance();
   uint32_t len;
   uint32_t i;
@@ -518,7 +2474,7 @@ static bool genCapsByJSArray(napi_env env, napi_value jsmsg,
     if (tp == napi_number) {
       double d;
       napi_get_value_double(env, v, &d);
-      caps->write(d);
+      writeJSNumber(d, caps, flags);
     } else if (tp == napi_string) {
       size_t strlen;
       char* str;
@@ -528,17 +2484,18 @@ static bool genCapsByJSArray(napi_env env, napi_value jsmsg,
       str[strlen] = '\0';
       caps->write(str);
       delete[] str;
-      // iotjs not support ArrayBuffer
-      // } else if (v.IsArrayBuffer()) {
-      //   caps->write(v.As<ArrayBuffer>().Data(),
-      //   v.As<ArrayBuffer>().ByteLength());
     } else if (tp == napi_object) {
       bool isArray;
       napi_is_array(env, v, &isArray);
-      if (!isArray)
+      if (!isArray) {
+#ifdef NAPI_BINARY_SUPPORTED
+        if (writeJSBinary(env, v, caps, flags))
+          continue;
+#endif
         return false;
+      }
       shared_ptr<Caps> sub;
-      if (!genCapsByJSArray(env, v, sub))
+      if (!genCapsByJSArray(env, v, sub, flags))
         return false;
       caps->write(sub);
     } else if (tp == napi_null) {
@@ -551,6 +2508,86 @@ static bool genCapsByJSArray(napi_env env, napi_value jsmsg,
   return true;
 }
 
+// one js value as member of prepared msg
+static bool genCapsMemberByJS(napi_env env, napi_value v, CapsMember& m,
+                              uint32_t flags) {
+  napi_valuetype tp;
+  napi_typeof(env, v, &tp);
+  if (tp == napi_number) {
+    double d;
+    napi_get_value_double(env, v, &d);
+    m.type = numberCapsType(d, flags);
+    if (m.type == CAPS_MEMBER_TYPE_INTEGER)
+      m.num.iv = static_cast<int32_t>(d);
+    else if (m.type == CAPS_MEMBER_TYPE_LONG)
+      m.num.lv = static_cast<int64_t>(d);
+    else
+      m.num.dv = d;
+  } else if (tp == napi_string) {
+    m.type = CAPS_MEMBER_TYPE_STRING;
+    m.str = Napi::String(env, v).Utf8Value();
+  } else if (tp == napi_object) {
+    bool isArray;
+    napi_is_array(env, v, &isArray);
+    if (isArray) {
+      m.type = CAPS_MEMBER_TYPE_OBJECT;
+      return genCapsByJSArray(env, v, m.obj, flags);
+    }
+#ifdef NAPI_BINARY_SUPPORTED
+    shared_ptr<Caps> tmp = Caps::new_instance();
+    // prepared msg posted many times, never by memfd
+    if (writeJSBinary(env, v, tmp, 0)) {
+      const void* data;
+      uint32_t length;
+      tmp->rewind();
+      if (tmp->read(data, length) != CAPS_SUCCESS)
+        return false;
+      m.type = CAPS_MEMBER_TYPE_BINARY;
+      m.str.assign(reinterpret_cast<const char*>(data), length);
+      return true;
+    }
+#endif
+    return false;
+  } else if (tp == napi_null || tp == napi_undefined) {
+    m.type = CAPS_MEMBER_TYPE_VOID;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+// member of prepared msg, binary held in str
+static void writeCapsMember(shared_ptr<Caps>& caps, const CapsMember& m) {
+  shared_ptr<Caps> obj;
+  switch (m.type) {
+    case CAPS_MEMBER_TYPE_INTEGER:
+      caps->write(m.num.iv);
+      break;
+    case CAPS_MEMBER_TYPE_LONG:
+      caps->write(m.num.lv);
+      break;
+    case CAPS_MEMBER_TYPE_FLOAT:
+      caps->write(m.num.fv);
+      break;
+    case CAPS_MEMBER_TYPE_DOUBLE:
+      caps->write(m.num.dv);
+      break;
+    case CAPS_MEMBER_TYPE_STRING:
+      caps->write(m.str);
+      break;
+    case CAPS_MEMBER_TYPE_BINARY:
+      caps->write(m.str.data(), m.str.length());
+      break;
+    case CAPS_MEMBER_TYPE_OBJECT:
+      obj = m.obj;
+      caps->write(obj);
+      break;
+    default:
+      caps->write();
+      break;
+  }
+}
+
 static bool genCapsByJSCaps(napi_env env, napi_value jsmsg,
                             shared_ptr<Caps>& caps) {
   void* ptr = nullptr;
@@ -562,84 +2599,228 @@ static bool genCapsByJSCaps(napi_env env, napi_value jsmsg,
 }
 
 static void freeHackedCaps(napi_env, void* data, void* arg) {
-  delete reinterpret_cast<HackedNativeCaps*>(data);
+  HackedNativeCaps* hackedCaps = reinterpret_cast<HackedNativeCaps*>(data);
+  hackedCaps->caps.reset();
+  hackedCaps->flat.reset();
+  hackedCaps->storage.reset();
+  hackedCaps->shm.reset();
+  hackedCaps->membersEnd = false;
+  hackedCaps->members.clear();
+  hackedCapsPool.put(hackedCaps);
 }
 
-static napi_value genHackedCaps(napi_env env, shared_ptr<Caps> msg) {
+static napi_value genHackedCaps(napi_env env, shared_ptr<Caps> msg,
+                                shared_ptr<FlatMsg> flat,
+                                shared_ptr<Caps> storage,
+                                shared_ptr<ShmBinaries> shm) {
   napi_value jsobj;
-  HackedNativeCaps* hackedCaps = new HackedNativeCaps();
+  HackedNativeCaps* hackedCaps = hackedCapsPool.get();
   hackedCaps->caps = msg;
+  hackedCaps->flat = std::move(flat);
+  hackedCaps->storage = std::move(storage);
+  hackedCaps->shm = std::move(shm);
   if (napi_create_external(env, hackedCaps, freeHackedCaps, nullptr, &jsobj) !=
       napi_ok) {
-    delete hackedCaps;
+    freeHackedCaps(env, hackedCaps, nullptr);
     napi_get_undefined(env, &jsobj);
     return jsobj;
   }
   return jsobj;
 }
 
-static napi_value createSenderObject(napi_env env, MsgCallbackInfo& cbinfo) {
+// { pid, name } or { ipaddr, port, name }, properties read only
+static napi_value createSenderObject(napi_env env, MsgSenderInfo& sender) {
   napi_value res;
-  napi_value val;
+  napi_property_descriptor props[3];
+  size_t count = 0;
+  memset(props, 0, sizeof(props));
   napi_create_object(env, &res);
-  if (cbinfo.sender.type == 0) {
-    napi_create_uint32(env, cbinfo.sender.pid, &val);
-    napi_set_named_property(env, res, "pid", val);
+  if (sender.type == 0) {
+    props[count].utf8name = "pid";
+    napi_create_uint32(env, sender.pid, &props[count++].value);
   } else {
-    napi_create_string_utf8(env, cbinfo.sender.ipaddr.c_str(),
-                            cbinfo.sender.ipaddr.length(), &val);
-    napi_set_named_property(env, res, "ipaddr", val);
-    napi_create_uint32(env, cbinfo.sender.port, &val);
-    napi_set_named_property(env, res, "port", val);
-  }
-  napi_create_string_utf8(env, cbinfo.sender.name.c_str(),
-                          cbinfo.sender.name.length(), &val);
-  napi_set_named_property(env, res, "name", val);
+    props[count].utf8name = "ipaddr";
+    napi_create_string_utf8(env, sender.ipaddr.c_str(), sender.ipaddr.length(),
+                            &props[count++].value);
+    props[count].utf8name = "port";
+    napi_create_uint32(env, sender.port, &props[count++].value);
+  }
+  props[count].utf8name = "name";
+  napi_create_string_utf8(env, sender.name.c_str(), sender.name.length(),
+                          &props[count++].value);
+  for (size_t i = 0; i < count; ++i)
+    props[i].attributes = napi_enumerable;
+  napi_define_properties(env, res, count, props);
+  // shared by handlers, no property added either
+#if NAPI_VERSION >= 8
+  napi_object_freeze(env, res);
+#else
+  napi_value global;
+  napi_value object;
+  napi_value freeze;
+  if (napi_get_global(env, &global) == napi_ok &&
+      napi_get_named_property(env, global, "Object", &object) == napi_ok &&
+      napi_get_named_property(env, object, "freeze", &freeze) == napi_ok)
+    napi_call_function(env, object, freeze, 1, &res, nullptr);
+#endif
+  return res;
+}
+
+// sender object of msg, shared by msgs from same peer.
+// undefined if no handler wants it
+napi_value ClientNative::senderObject(MsgCallbackInfo& cbinfo) {
+  napi_value res;
+  if (!cbinfo.hasSender) {
+    napi_get_undefined(cbinfo.env, &res);
+    return res;
+  }
+  auto it = senderObjects.find(cbinfo.sender);
+  if (it != senderObjects.end() &&
+      napi_get_reference_value(cbinfo.env, it->second, &res) == napi_ok &&
+      res != nullptr) {
+    return res;
+  }
+  if (senderObjects.size() >= MAX_CACHED_SENDERS)
+    clearSenderObjects();
+  res = createSenderObject(cbinfo.env, cbinfo.sender);
+  napi_ref ref;
+  if (napi_create_reference(cbinfo.env, res, 1, &ref) == napi_ok)
+    senderObjects[cbinfo.sender] = ref;
   return res;
 }
 
+void ClientNative::clearSenderObjects() {
+  for (auto it = senderObjects.begin(); it != senderObjects.end(); ++it)
+    napi_delete_reference(thisEnv, it->second);
+  senderObjects.clear();
+}
+
+// params of methods declared with option stream:
+// [ stream msg name, params ], chunks of callee posted to stream msg name
+static bool unwrapStreamCall(shared_ptr<Caps>& msg, std::string& stream,
+                             shared_ptr<Caps>& params) {
+  if (msg.get() == nullptr || msg->next_type() != CAPS_MEMBER_TYPE_STRING)
+    return false;
+  bool r = msg->read_string(stream) == CAPS_SUCCESS;
+  if (r && msg->next_type() == CAPS_MEMBER_TYPE_OBJECT)
+    msg->read(params);
+  msg->rewind();
+  return r;
+}
+
+// one decoded msg fanned out to all handlers of msg name wanted it.
+// handlers get remaining count of handlers after it, for sharing decoded msg.
+// no js object created if msg replaced by newer one for all handlers
+void ClientNative::dispatchMsg(MsgCallbackInfo& cbinfo) {
+  const SubscriptionHandlers* hs = cbinfo.handlers.get();
+  if (hs == nullptr)
+    return;
+  if (cbinfo.topic >= subscriptions.size() || !subscriptions[cbinfo.topic])
+    return;
+  Subscription* sub = subscriptions[cbinfo.topic].get();
+  // handlers may unsubscribe while dispatching, take functions first
+  std::vector<napi_value> fns;
+  size_t i;
+  for (i = 0; i < hs->ids.size(); ++i) {
+    if (i < MAX_MASKED_HANDLERS) {
+      if (!(cbinfo.handlerMask & ((uint64_t)1 << i)))
+        continue;
+      // coalesce 'latest', newer msg pending
+      if (hs->limits[i] && hs->limits[i]->latestOnly &&
+          hs->limits[i]->latestSeq.load() > cbinfo.seq)
+        continue;
+    } else if (hs->filters[i] &&
+               !matchMsgFilter(*hs->filters[i], cbinfo.msg)) {
+      continue;
+    }
+    auto cbit = sub->callbacks.find(hs->ids[i]);
+    if (cbit != sub->callbacks.end())
+      fns.push_back(cbit->second.fn.Value());
+  }
+  if (fns.empty())
+    return;
+  napi_value jsmsg = genHackedCaps(cbinfo.env, cbinfo.msg, cbinfo.flat,
+                                   cbinfo.ownsStorage ? cbinfo.msg : nullptr,
+                                   cbinfo.shm);
+  napi_value senderObj = senderObject(cbinfo);
+  napi_value jstype = Number::New(cbinfo.env, cbinfo.msgtype);
+  for (i = 0; i < fns.size(); ++i) {
+    Function(cbinfo.env, fns[i])
+        .MakeCallback(cbinfo.env.Global(),
+                      { jsmsg, jstype, senderObj,
+                        Number::New(cbinfo.env, fns.size() - i - 1) },
+                      asyncContext);
+  }
+}
+
 void ClientNative::handleMsgCallbacks() {
   napi_value jsmsg;
-  SubscriptionMap::iterator subit;
-  unique_lock<mutex> locker(cb_mutex);
-  list<MsgCallbackInfo>::iterator mit = pendingMsgs.begin();
-  list<MsgCallbackInfo>::iterator rmit;
-  locker.unlock();
+  MsgCallbackInfo cbinfo;
+  uint32_t handled = 0;
+  uint64_t deadline = 0;
 
+  // closed, async handles wait for callbacks of rejected calls
+  if (!(status & NATIVE_STATUS_STARTED))
+    return;
+  if (trailingChanged.exchange(false))
+    scheduleTrailing();
+  // handlers may subscribe again, replayed in next callback
+  if (!replays.empty()) {
+    std::vector<MsgCallbackInfo> rs;
+    rs.swap(replays);
+    for (auto it = rs.begin(); it != rs.end(); ++it) {
+      HandleScope scope(it->env);
+      dispatchMsg(*it);
+    }
+  }
+  if (dispatchBudgetUs > 0)
+    deadline = uv_hrtime() + (uint64_t)dispatchBudgetUs * 1000;
+  pendingMsgs.beginDrain();
   while (true) {
-    locker.lock();
-    if (mit == pendingMsgs.end())
+    // budget used up, yield to event loop and continue in next callback.
+    // may wake up once more for nothing if queue is empty right now
+    if ((dispatchBudgetMsgs > 0 && handled >= dispatchBudgetMsgs) ||
+        (deadline > 0 && handled > 0 && uv_hrtime() >= deadline)) {
+      uv_async_send(&msgAsync);
       break;
-    MsgCallbackInfo cbinfo(*mit);
-    locker.unlock();
-
+    }
+    if (!popPendingMsg(cbinfo))
+      break;
+    ++handled;
     HandleScope scope(cbinfo.env);
-    jsmsg = genHackedCaps(cbinfo.env, cbinfo.msg);
-    auto senderObj = createSenderObject(cbinfo.env, cbinfo);
     if (cbinfo.msgtype < FLORA_NUMBER_OF_MSGTYPE) {
-      subit = subscriptions.find(cbinfo.msgName);
-      if (subit != subscriptions.end()) {
-        subit->second.MakeCallback(cbinfo.env.Global(),
-                                   { jsmsg,
-                                     Number::New(cbinfo.env, cbinfo.msgtype),
-                                     senderObj },
-                                   asyncContext);
-      }
+      dispatchMsg(cbinfo);
     } else {
-      subit = remoteMethods.find(cbinfo.msgName);
-      if (subit != remoteMethods.end()) {
-        napi_value jsreply =
-            NativeReply::createObject(cbinfo.env, cbinfo.reply);
-        subit->second.MakeCallback(cbinfo.env.Global(),
-                                   { jsmsg, jsreply, senderObj },
-                                   asyncContext);
+      HandlerCallback* method = cbinfo.topic < remoteMethods.size()
+                                    ? remoteMethods[cbinfo.topic].get()
+                                    : nullptr;
+      // removed, topic id may be reused by other method since
+      if (method && method->id == cbinfo.seq) {
+        napi_value jsstream = cbinfo.env.Undefined();
+        if (method->stream) {
+          std::string stream;
+          shared_ptr<Caps> params;
+          if (!unwrapStreamCall(cbinfo.msg, stream, params)) {
+            cbinfo.reply->write_code(ERROR_INVALID_PARAM);
+            cbinfo.reply->end();
+            continue;
+          }
+          jsmsg = genHackedCaps(cbinfo.env, params, nullptr, nullptr,
+                                cbinfo.shm);
+          jsstream = String::New(cbinfo.env, stream);
+        } else {
+          jsmsg = genHackedCaps(cbinfo.env, cbinfo.msg, cbinfo.flat, nullptr,
+                                cbinfo.shm);
+        }
+        napi_value senderObj = senderObject(cbinfo);
+        // caller could not tell replying process, no shared memory
+        napi_value jsreply = NativeReply::createObject(
+            cbinfo.env, cbinfo.reply, encodeFlags & ~CAPS_ENCODE_SHARED_MEMORY);
+        method->fn.MakeCallback(cbinfo.env.Global(),
+                                { jsmsg, jsreply, senderObj, jsstream },
+                                asyncContext);
       }
     }
-    locker.lock();
-    rmit = mit;
-    ++mit;
-    pendingMsgs.erase(rmit);
-    locker.unlock();
   }
 }
 
@@ -654,32 +2835,48 @@ static Value genJSResponse(napi_env env, Response& resp) {
   return scope.Escape(jsresp);
 }
 
-void ClientNative::handleRespCallbacks() {
-  unique_lock<mutex> locker(cb_mutex, defer_lock);
-  list<RespCallbackInfo>::iterator it;
+// [ { code, response }, ... ], response undefined if code is not 0
+static Value genJSGroupResponse(napi_env env, CallGroup& group) {
+  EscapableHandleScope scope(env);
+  Array results = Array::New(env, group.rescodes.size());
+  for (uint32_t i = 0; i < group.rescodes.size(); ++i) {
+    Object res = Object::New(env);
+    res["code"] = Number::New(env, group.rescodes[i]);
+    if (group.rescodes[i] == FLORA_CLI_SUCCESS)
+      res["response"] = genJSResponse(env, group.responses[i]);
+    results.Set(i, res);
+  }
+  return scope.Escape(results);
+}
 
-  while (true) {
-    locker.lock();
-    if (pendingResponses.empty())
-      break;
-    it = pendingResponses.begin();
-    locker.unlock();
+void ClientNative::handleRespCallbacks() {
+  RespCallbackInfo cbinfo;
 
-    HandleScope scope((*it).env);
+  pendingResponses.beginDrain();
+  while (pendingResponses.pop(cbinfo)) {
+    HandleScope scope(cbinfo.env);
     napi_value global;
     napi_value res;
     napi_value cb;
     napi_value args[2];
-    napi_create_int32(it->env, it->rescode, args);
-    args[1] = genJSResponse((*it).env, (*it).response);
-    napi_get_global(it->env, &global);
-    napi_get_reference_value(it->env, it->cbr, &cb);
-    napi_make_callback(it->env, asyncContext, global, cb, 2, args, &res);
-    napi_delete_reference(it->env, it->cbr);
-    locker.lock();
-    pendingResponses.pop_front();
-    locker.unlock();
+    size_t argc = 2;
+    if (cbinfo.group) {
+      args[0] = genJSGroupResponse(cbinfo.env, *cbinfo.group);
+      argc = 1;
+      cbinfo.group.reset();
+    } else {
+      napi_create_int32(cbinfo.env, cbinfo.rescode, args);
+      args[1] = genJSResponse(cbinfo.env, cbinfo.response);
+    }
+    napi_get_global(cbinfo.env, &global);
+    napi_get_reference_value(cbinfo.env, cbinfo.cbr, &cb);
+    napi_make_callback(cbinfo.env, asyncContext, global, cb, argc, args,
+                       &res);
+    napi_delete_reference(cbinfo.env, cbinfo.cbr);
   }
+  // callbacks of calls rejected by close invoked
+  if (handlesClosePending)
+    closeHandles();
 }
 
 void NativeReply::init(napi_env env) {
@@ -714,14 +2911,17 @@ napi_value NativeReply::newInstance(napi_env env, napi_callback_info cbinfo) {
 }
 
 napi_value NativeReply::createObject(napi_env env,
-                                     shared_ptr<flora::Reply>& reply) {
+                                     shared_ptr<flora::Reply>& reply,
+                                     uint32_t encodeFlags) {
   napi_escapable_handle_scope scope;
   napi_open_escapable_handle_scope(env, &scope);
 
   napi_value res, cons;
   napi_get_reference_value(env, replyConstructor, &cons);
   napi_new_instance(env, cons, 0, nullptr, &res);
-  NativeReply* nativeReply = new NativeReply(reply);
+  NativeReply* nativeReply = replyPool.get();
+  nativeReply->reply = reply;
+  nativeReply->encodeFlags = encodeFlags;
   napi_wrap(env, res, nativeReply, NativeReply::objectFinalize, nullptr,
             nullptr);
 
@@ -731,7 +2931,9 @@ napi_value NativeReply::createObject(napi_env env,
 }
 
 void NativeReply::objectFinalize(napi_env env, void* data, void* hint) {
-  delete reinterpret_cast<NativeReply*>(data);
+  NativeReply* nativeReply = reinterpret_cast<NativeReply*>(data);
+  nativeReply->reply.reset();
+  replyPool.put(nativeReply);
 }
 
 #define MAX_NATIVE_ARGS 16
@@ -777,7 +2979,8 @@ napi_value NativeReply::writeCode(napi_env env, napi_value thisObj, size_t argc,
     if (tp == napi_number) {
       int32_t code;
       napi_get_value_int32(env, argv[0], &code);
-      reply->write_code(code);
+      if (reply)
+        reply->write_code(code);
     }
   }
   napi_value r;
@@ -792,7 +2995,7 @@ napi_value NativeReply::writeData(napi_env env, napi_value thisObj, size_t argc,
     shared_ptr<Caps> caps;
     napi_is_array(env, argv[0], &isArray);
     if (isArray) {
-      if (!genCapsByJSArray(env, argv[0], caps))
+      if (!genCapsByJSArray(env, argv[0], caps, encodeFlags))
         goto exit;
     } else {
       napi_valuetype tp;
@@ -803,7 +3006,8 @@ napi_value NativeReply::writeData(napi_env env, napi_value thisObj, size_t argc,
       if (!genCapsByJSCaps(env, argv[0], caps))
         goto exit;
     }
-    reply->write_data(caps);
+    if (reply)
+      reply->write_data(caps);
   }
 
 exit:
@@ -820,7 +3024,10 @@ napi_value NativeReply::end(napi_env env, napi_value thisObj, size_t argc,
   if (argc >= 2) {
     writeData(env, thisObj, 1, argv + 1);
   }
-  reply->end();
+  if (reply) {
+    reply->end();
+    reply.reset();
+  }
   napi_value r;
   napi_get_undefined(env, &r);
   return r;
@@ -828,6 +3035,8 @@ napi_value NativeReply::end(napi_env env, napi_value thisObj, size_t argc,
 
 static Object InitNode(Napi::Env env, Object exports) {
   NativeReply::init(env);
+  exports.Set("lazyLength", Function::New(env, lazyLength, "lazyLength"));
+  exports.Set("lazyGet", Function::New(env, lazyGet, "lazyGet"));
   return NativeObjectWrap::Init(env, exports);
 }
 
@@ -1,33 +1,241 @@
 #pragma once
 
 #include <map>
-#include <list>
+#include <memory>
+#include <vector>
 #include <mutex>
+#include <atomic>
 #include <condition_variable>
 #include "napi.h"
 #include "flora-agent.h"
 #include "uv.h"
+#include "pending-queue.h"
+#include "object-pool.h"
+#include "msg-filter.h"
+#include "msg-fragment.h"
+#include "shm-binary.h"
+#include "flat-msg.h"
+#include "flora-connection.h"
+
+class HandlerCallback {
+ public:
+  Napi::FunctionReference fn;
+  // NativeObjectWrap added this handler, agents created with
+  // shareConnection share one ClientNative
+  uint32_t owner = 0;
+  // method declared with option stream, called by Agent.callStream
+  bool stream = false;
+  // declaration of method, invocations queued for a removed method never
+  // reach a method declared later on same topic id
+  uint32_t id = 0;
+};
+
+// msg and method names interned to compact ids when subscribed or declared,
+// flora callbacks carry the id and dispatch indexes arrays by it.
+// ids of names neither subscribed nor declared released and reused,
+// js thread only
+class TopicTable {
+ public:
+  uint32_t intern(const std::string& name) {
+    auto it = ids.find(name);
+    if (it != ids.end())
+      return it->second;
+    uint32_t id;
+    if (freeIds.empty()) {
+      id = names.size();
+      names.push_back(name);
+    } else {
+      id = freeIds.back();
+      freeIds.pop_back();
+      names[id] = name;
+    }
+    ids.insert(std::make_pair(name, id));
+    return id;
+  }
+
+  void release(uint32_t id) {
+    ids.erase(names[id]);
+    names[id].clear();
+    freeIds.push_back(id);
+  }
+
+  bool find(const std::string& name, uint32_t& id) const {
+    auto it = ids.find(name);
+    if (it == ids.end())
+      return false;
+    id = it->second;
+    return true;
+  }
+
+  const std::string& name(uint32_t id) const {
+    return names[id];
+  }
+
+  uint32_t size() const {
+    return names.size();
+  }
+
+ private:
+  std::map<std::string, uint32_t> ids;
+  std::vector<std::string> names;
+  std::vector<uint32_t> freeIds;
+};
+
+// maxRate and coalesce options of a handler, state updated on flora thread
+class MsgCallbackInfo;
+
+class HandlerLimit {
+ public:
+  // 0 means unlimited
+  uint64_t minIntervalNs = 0;
+  // coalesce 'latest'
+  bool latestOnly = false;
+  // uv_hrtime of last msg passed
+  std::atomic<uint64_t> lastTime{ 0 };
+  // seq of newest msg passed maxRate, older trailing msg dropped
+  std::atomic<uint64_t> passedSeq{ 0 };
+  // seq of newest msg queued for the handler, older ones skipped
+  // when dispatching
+  std::atomic<uint64_t> latestSeq{ 0 };
+  // newest msg dropped by maxRate in current interval, dispatched when
+  // interval ends. guarded by ClientNative::trailingMutex
+  std::shared_ptr<MsgCallbackInfo> trailing;
+};
+
+// lanes of pending msgs and responses, lower value drained first
+#define PRIORITY_HIGH 0
+#define PRIORITY_NORMAL 1
+#define PRIORITY_LOW 2
+#define NUMBER_OF_PRIORITY 3
 
-typedef std::map<std::string, Napi::FunctionReference> SubscriptionMap;
+// handlers of a msg name visible to flora thread.
+// immutable, replaced as a whole when handlers added or removed
+class SubscriptionHandlers {
+ public:
+  std::vector<uint32_t> ids;
+  std::vector<std::shared_ptr<MsgFilter> > filters;
+  std::vector<std::shared_ptr<HandlerLimit> > limits;
+  std::vector<uint32_t> priorities;
+  // false if handler subscribed with option sender: false
+  std::vector<bool> senders;
+  // true if handler takes chunks of Agent.callStream
+  std::vector<bool> streams;
+  // highest priority of all handlers, lane of all msgs of the name
+  uint32_t lane = PRIORITY_LOW;
+  // sender info copied from flora only if any handler wants it
+  bool anySender = false;
+  bool filtered = false;
+  bool limited = false;
+  // msgs are stream chunks, never dropped by overflow policy
+  bool stream = false;
+};
+
+// shared by Subscription and flora subscribe callback,
+// current accessed by std::atomic_load/atomic_store
+class SharedHandlers {
+ public:
+  std::shared_ptr<const SubscriptionHandlers> current;
+};
+
+// handlers of first MAX_MASKED_HANDLERS of a msg name matched on flora
+// thread, others matched on js thread and limits not applied
+#define MAX_MASKED_HANDLERS 64
+
+class Subscription {
+ public:
+  // js thread only
+  std::map<uint32_t, HandlerCallback> callbacks;
+  std::shared_ptr<SharedHandlers> shared;
+};
+
+
+// also key of ClientNative::senderObjects
+class MsgSenderInfo {
+ public:
+  bool operator<(const MsgSenderInfo& o) const {
+    if (type != o.type)
+      return type < o.type;
+    if (pid != o.pid)
+      return pid < o.pid;
+    if (port != o.port)
+      return port < o.port;
+    if (ipaddr != o.ipaddr)
+      return ipaddr < o.ipaddr;
+    return name < o.name;
+  }
+
+  uint16_t type = 0;
+  uint16_t port = 0;
+  uint32_t pid = 0;
+  std::string name;
+  std::string ipaddr;
+};
 
 class MsgCallbackInfo {
  public:
+  MsgCallbackInfo() : msgtype(FLORA_MSGTYPE_INSTANT), env(nullptr) {
+  }
+
   explicit MsgCallbackInfo(Napi::Env e)
       : msgtype(FLORA_MSGTYPE_INSTANT), env(e) {
   }
 
-  std::string msgName;
+  // id in ClientNative::topics
+  uint32_t topic = 0;
   std::shared_ptr<Caps> msg;
+  // msg decoded on flora thread, null if predecode not set
+  std::shared_ptr<FlatMsg> flat;
   uint32_t msgtype;
+  // bytes accounted in pending queue limit
+  uint32_t bytes = 0;
   Napi::Env env;
   std::shared_ptr<flora::Reply> reply;
-  struct {
-    uint16_t type;
-    uint16_t port;
-    uint32_t pid;
-    std::string name;
-    std::string ipaddr;
-  } sender;
+  // handlers when msg received, bit i of handlerMask set if
+  // handlers->ids[i] wants this msg
+  std::shared_ptr<const SubscriptionHandlers> handlers;
+  uint64_t handlerMask = 0;
+  // msg parsed from a copy by this module, binaries borrowed from it
+  bool ownsStorage = false;
+  // order of msgs of subscriptions, for coalescing.
+  // HandlerCallback::id of method for invocations
+  uint64_t seq = 0;
+  uint32_t lane = PRIORITY_NORMAL;
+  // empty if no handler wants it
+  MsgSenderInfo sender;
+  bool hasSender = false;
+  // memfds of msg mapped on flora thread, null if agent option
+  // sharedMemory not set or msg has none
+  std::shared_ptr<ShmBinaries> shm;
+  // method invocation or stream chunk, never dropped by overflow policy
+  // and not counted in queue limits
+  bool pinned = false;
+};
+
+// calls of Agent.callMany, callback invoked once when all targets
+// responded or failed
+class CallGroup {
+ public:
+  // id in ClientNative::inflightCalls
+  uint32_t callId = 0;
+  std::mutex mutex;
+  uint32_t remaining = 0;
+  std::vector<int32_t> rescodes;
+  std::vector<flora::Response> responses;
+};
+
+// call waiting for response, removed when flora invoked callback of it
+// or agent closed
+class InflightCall {
+ public:
+  napi_ref cbr;
+  std::string name;
+  // empty for callMany
+  std::string target;
+  // uv_hrtime
+  uint64_t startTime;
+  uint32_t timeout;
+  uint32_t lane = PRIORITY_NORMAL;
+  std::shared_ptr<CallGroup> group;
 };
 
 class RespCallbackInfo {
@@ -36,16 +244,107 @@ public:
   napi_ref cbr;
   int32_t rescode;
   flora::Response response;
+  uint32_t lane = PRIORITY_NORMAL;
+  // not null if response of callMany
+  std::shared_ptr<CallGroup> group;
+};
+
+// member of caps read for format 'lazy' and prepared msgs
+class CapsMember {
+ public:
+  int32_t type;
+  union {
+    int32_t iv;
+    int64_t lv;
+    float fv;
+    double dv;
+  } num;
+  // string of prepared msg
+  std::string str;
+  // string of lazy msg, points to storage of caps
+  const char* cstr = nullptr;
+  std::shared_ptr<Caps> obj;
+  // binary member, points to storage of caps, copied or borrowed
+  // as HackedNativeCaps::storage says
+  const void* bin = nullptr;
+  uint32_t binLength = 0;
 };
 
 class HackedNativeCaps {
  public:
+  // must be first member, @yoda/caps access it as HackedNativeCaps too
   std::shared_ptr<Caps> caps;
+  // decoded on flora thread if agent option predecode set
+  std::shared_ptr<FlatMsg> flat;
+  // top level msg owning storage of binary members, Buffers borrow it.
+  // null if storage may be receive buffer of flora, binaries copied
+  std::shared_ptr<Caps> storage;
+  // format 'lazy', members read from caps on demand, in order.
+  // membersEnd set when all members read
+  bool membersEnd = false;
+  std::vector<CapsMember> members;
+  // memfds of msg mapped, null if agent option sharedMemory not set
+  std::shared_ptr<ShmBinaries> shm;
 };
 
+// msg of Agent.prepare, name and members converted once, posted many times
+class PreparedMsg {
+ public:
+  std::string name;
+  std::shared_ptr<Caps> msg;
+  // top level members, read from msg on first patch.
+  // binary members held in str, not pointing to msg.
+  // msg rebuilt from members before next post if dirty
+  bool membersRead = false;
+  std::vector<CapsMember> members;
+  bool dirty = false;
+};
+
+typedef struct {
+  uint32_t reconnInterval;
+  uint32_t bufsize;
+  uint32_t beepInterval;
+  uint32_t norespTimeout;
+  uint32_t maxPendingMsgs;
+  uint32_t maxPendingBytes;
+  uint32_t overflowPolicy;
+  uint32_t dispatchBudgetMsgs;
+  uint32_t dispatchBudgetUs;
+  uint32_t encodeFlags;
+  bool predecode;
+  bool fragment;
+} AgentOptions;
+
 #define NATIVE_STATUS_CONFIGURED 0x1
 #define NATIVE_STATUS_STARTED 0x2
-#define ASYNC_HANDLE_COUNT 2
+// msgAsync, respAsync, trailingTimer
+#define ASYNC_HANDLE_COUNT 3
+// preallocated slots of pending msgs/responses ring
+#define DEFAULT_PENDING_QUEUE_CAPACITY 256
+
+#define MAX_CACHED_SENDERS 64
+
+// what to do when pending msgs exceed maxPendingMsgs/maxPendingBytes
+#define OVERFLOW_POLICY_DROP_OLDEST 0
+#define OVERFLOW_POLICY_DROP_NEWEST 1
+#define OVERFLOW_POLICY_BLOCK 2
+
+// flags of js msg -> caps encoding
+// write every number as double, as versions before integer encoding
+#define CAPS_ENCODE_ALWAYS_DOUBLE 0x1
+// large binary members passed by memfd, unix: uri only
+#define CAPS_ENCODE_SHARED_MEMORY 0x2
+
+class ClientNative;
+
+// held by flora callbacks instead of ClientNative, client cleared when
+// closed. callbacks of a connection shared by threads may still be running
+// after the client closed
+class ClientAnchor {
+ public:
+  std::mutex mutex;
+  ClientNative* client = nullptr;
+};
 
 class ClientNative {
  public:
@@ -53,54 +352,235 @@ class ClientNative {
 
   void handleRespCallbacks();
 
+  void dispatchTrailing();
+
   Napi::Value start(const Napi::CallbackInfo& info);
 
-  Napi::Value subscribe(const Napi::CallbackInfo& info);
+  Napi::Value subscribe(const Napi::CallbackInfo& info, uint32_t owner);
 
-  Napi::Value unsubscribe(const Napi::CallbackInfo& info);
+  Napi::Value unsubscribe(const Napi::CallbackInfo& info, uint32_t owner);
 
-  Napi::Value declareMethod(const Napi::CallbackInfo& info);
+  Napi::Value declareMethod(const Napi::CallbackInfo& info, uint32_t owner);
 
-  Napi::Value removeMethod(const Napi::CallbackInfo& info);
+  Napi::Value removeMethod(const Napi::CallbackInfo& info, uint32_t owner);
 
   Napi::Value post(const Napi::CallbackInfo& info);
 
+  Napi::Value postChunk(const Napi::CallbackInfo& info);
+
+  Napi::Value postBatch(const Napi::CallbackInfo& info);
+
   Napi::Value call(const Napi::CallbackInfo& info);
 
+  Napi::Value callMany(const Napi::CallbackInfo& info);
+
+  Napi::Value cancelCall(const Napi::CallbackInfo& info);
+
+  Napi::Value prepare(const Napi::CallbackInfo& info);
+
+  Napi::Value postPrepared(const Napi::CallbackInfo& info);
+
+  Napi::Value setPrepared(const Napi::CallbackInfo& info);
+
   Napi::Value genArray(const Napi::CallbackInfo& info);
 
   Napi::Value getSocket(const Napi::CallbackInfo& info);
 
-  void initialize(const Napi::CallbackInfo& info);
+  Napi::Value getQueueStats(const Napi::CallbackInfo& info);
+
+  Napi::Value pendingCalls(const Napi::CallbackInfo& info);
+
+  Napi::Value peek(const Napi::CallbackInfo& info);
+
+  void initialize(const Napi::CallbackInfo& info, bool shared);
 
   void close();
 
   void refDown();
 
+  // env of js thread torn down, stop delivery and close async handles
+  void envCleanup();
+
+  // shareConnection: one more agent use this connection
+  void attach();
+
+  // agent closed, remove handlers and methods of owner.
+  // connection closed when no agent use it
+  void detach(uint32_t owner);
+
+  // shareConnection: name of option of later agent conflicting with
+  // agent created this client, empty if none
+  std::string conflictingOption(const Napi::Value& jsopts);
+
+  // id in uri of agent created the connection, flora knows no other ids
+  const std::string& clientId() const;
+
+  std::string poolKey;
+
  private:
-  void msgCallback(const char* name, Napi::Env env, std::shared_ptr<Caps>& msg,
-                   uint32_t type, std::shared_ptr<flora::Reply> reply);
+  void closeHandles();
+
+  void replayPersistMsg(Napi::Env env, uint32_t topic, const std::string& name,
+                        uint32_t id);
+
+  void floraMsgCallback(uint32_t topic, const char* name, Napi::Env env,
+                        std::shared_ptr<SharedHandlers>& shared,
+                        std::shared_ptr<Caps>& msg, uint32_t type);
+
+  bool msgCallback(uint32_t topic, const char* name, Napi::Env env,
+                   std::shared_ptr<Caps>& msg, uint32_t type,
+                   std::shared_ptr<flora::Reply> reply,
+                   std::shared_ptr<const SubscriptionHandlers> handlers,
+                   uint64_t handlerMask, uint64_t seq, uint32_t lane,
+                   bool withSender, bool ownsStorage = false,
+                   std::shared_ptr<ShmBinaries> shm = nullptr);
+
+  void initMsgCallbackInfo(MsgCallbackInfo& cbinfo, uint32_t topic,
+                           std::shared_ptr<Caps>& msg, uint32_t type,
+                           std::shared_ptr<const SubscriptionHandlers> handlers,
+                           uint64_t handlerMask, uint64_t seq, uint32_t lane,
+                           bool withSender, bool ownsStorage,
+                           std::shared_ptr<ShmBinaries> shm);
+
+  void keepTrailing(uint32_t topic, Napi::Env env, std::shared_ptr<Caps>& msg,
+                    uint32_t type,
+                    std::shared_ptr<const SubscriptionHandlers>& handlers,
+                    uint64_t throttled, uint64_t seq, bool ownsStorage,
+                    std::shared_ptr<ShmBinaries>& shm);
+
+  bool mapShm(const char* name, std::shared_ptr<Caps>& msg, bool wanted,
+              std::shared_ptr<ShmBinaries>& shm);
 
-  void respCallback(napi_env env, napi_ref cbr, int32_t rescode,
+  uint32_t postFlags(const std::string& name, uint32_t msgtype);
+
+  void updateHandlers(Subscription& sub, uint32_t id,
+                      std::shared_ptr<MsgFilter> filter,
+                      std::shared_ptr<HandlerLimit> limit,
+                      uint32_t priority, bool sender, bool stream);
+
+  void dispatchMsg(MsgCallbackInfo& cbinfo);
+
+  void releaseTopic(uint32_t topic);
+
+  void scheduleTrailing();
+
+  napi_value senderObject(MsgCallbackInfo& cbinfo);
+
+  void clearSenderObjects();
+
+  void respCallback(napi_env env, uint32_t callId, int32_t rescode,
                     flora::Response& response);
 
+  void groupRespCallback(napi_env env, std::shared_ptr<CallGroup>& group,
+                         uint32_t idx, int32_t rescode,
+                         flora::Response* response);
+
+  void queueResponse(RespCallbackInfo& cbinfo);
+
+  uint32_t trackCall(napi_ref cbr, const std::string& name,
+                     const std::string& target, uint32_t timeout,
+                     uint32_t lane, std::shared_ptr<CallGroup> group);
+
+  // false if call not pending, its callback queued or rejected already
+  bool untrackCall(uint32_t id, InflightCall& call);
+
+  void rejectPendingCalls();
+
+  int32_t postCaps(const std::string& name, std::shared_ptr<Caps>& msg,
+                   uint32_t msgtype, uint32_t flags = 0);
+
+  int32_t postMsg(Napi::Env env, const Napi::Value& jsname,
+                  const Napi::Value& jsmsg, const Napi::Value& jstype,
+                  bool isCaps);
+
+  bool pendingMsgsOverLimit(uint32_t incomingBytes);
+
+  bool enqueueMsg(MsgCallbackInfo& cbinfo);
+
+  bool popPendingMsg(MsgCallbackInfo& cbinfo);
+
  private:
-  flora::Agent floraAgent;
-  SubscriptionMap subscriptions;
-  SubscriptionMap remoteMethods;
+  // private connection, or shared with agents of other js threads
+  std::shared_ptr<FloraConnection> connection;
+  std::shared_ptr<ClientAnchor> anchor;
+  TopicTable topics;
+  // indexed by topic id, null if not subscribed or declared
+  std::vector<std::unique_ptr<Subscription> > subscriptions;
+  std::vector<std::unique_ptr<HandlerCallback> > remoteMethods;
+  // read only sender objects reused across msgs, js thread only.
+  // flora tells nothing about peers disconnected, cache dropped as a whole
+  // when it grows over MAX_CACHED_SENDERS
+  std::map<MsgSenderInfo, napi_ref> senderObjects;
+  uint32_t lastHandlerId = 0;
+  std::atomic<uint64_t> lastMsgSeq{ 0 };
+  // cached persist msgs for handlers subscribed later, dispatched before
+  // pendingMsgs. js thread only
+  std::vector<MsgCallbackInfo> replays;
+  // count of agents use this connection
+  uint32_t attachCount = 1;
   uv_async_t msgAsync;
   uv_async_t respAsync;
-  std::list<MsgCallbackInfo> pendingMsgs;
-  std::list<RespCallbackInfo> pendingResponses;
-  std::mutex cb_mutex;
-  std::condition_variable cb_cond;
+  // limits of maxRate holding trailing msg, dispatched by trailingTimer.
+  // trailingChanged set by flora thread, timer rescheduled on js thread
+  uv_timer_t trailingTimer;
+  std::mutex trailingMutex;
+  std::vector<std::shared_ptr<HandlerLimit>> trailingLimits;
+  std::atomic<bool> trailingChanged{ false };
+  // higher lanes always drained first, within dispatch budget.
+  // OVERFLOW_POLICY_DROP_OLDEST with limits: flora thread evicts oldest of
+  // lowest lane, queue locked instead of SpscRing
+  LanedQueue<MsgCallbackInfo, NUMBER_OF_PRIORITY> pendingMsgs;
+  LanedQueue<RespCallbackInfo, NUMBER_OF_PRIORITY> pendingResponses;
+  // flora may invoke call callbacks from more than one thread,
+  // serialize producers of pendingResponses
+  std::mutex resp_mutex;
+  std::map<uint32_t, InflightCall> inflightCalls;
+  std::mutex calls_mutex;
+  uint32_t lastCallId = 0;
+  // inbound queue limits, 0 means unlimited
+  uint32_t maxPendingMsgs = 0;
+  uint32_t maxPendingBytes = 0;
+  uint32_t overflowPolicy = OVERFLOW_POLICY_DROP_OLDEST;
+  // msgs accounted in limits, pinned msgs never dropped and not counted
+  std::atomic<uint32_t> pendingMsgCount{ 0 };
+  std::atomic<uint32_t> pendingMsgBytes{ 0 };
+  std::atomic<uint32_t> droppedMsgs{ 0 };
+  std::atomic<uint32_t> pendingMsgHighWater{ 0 };
+  std::atomic<uint32_t> pendingBytesHighWater{ 0 };
+  // OVERFLOW_POLICY_BLOCK: flora thread wait for js thread drain
+  std::mutex block_mutex;
+  std::condition_variable block_cond;
+  std::atomic<bool> producerBlocked{ false };
+  std::atomic<bool> closing{ false };
+  bool envTearingDown = false;
+  // closed, async handles closed after respAsync invoked callbacks of
+  // rejected calls
+  bool handlesClosePending = false;
+  // max msgs/microseconds handled by one msgAsync callback, 0 means unlimited
+  uint32_t dispatchBudgetMsgs = 0;
+  uint32_t dispatchBudgetUs = 0;
+  uint32_t encodeFlags = 0;
+  // identifies this agent in acks of memfds received
+  int64_t shmReceiver = 0;
+  // decode msgs on flora thread
+  bool predecode = false;
+  // as given by agent created this client, before adjusted for uri
+  AgentOptions agentOptions;
+  // uri without client id, key of persist msgs cache
+  std::string dispatcherUri;
+  // instant msgs larger than this posted as fragments, bufsize of agent
+  // if option fragment set, 0 otherwise
+  uint32_t bufsize = 0;
+  BufferPool fragmentBuffers;
+  FragmentAssembler fragments{ fragmentBuffers };
   Napi::Reference<Napi::Value> thisRef;
   napi_async_context asyncContext = nullptr;
   napi_env thisEnv = 0;
   // CONFIGURED
   // STARTED
   uint32_t status = 0;
-  uint32_t asyncHandleCount = ASYNC_HANDLE_COUNT;
+  // async handles initialized and not closed yet
+  uint32_t asyncHandleCount = 0;
 };
 
 class NativeObjectWrap : public Napi::ObjectWrap<NativeObjectWrap> {
@@ -126,14 +606,40 @@ class NativeObjectWrap : public Napi::ObjectWrap<NativeObjectWrap> {
 
   Napi::Value post(const Napi::CallbackInfo& info);
 
+  Napi::Value postChunk(const Napi::CallbackInfo& info);
+
+  Napi::Value postBatch(const Napi::CallbackInfo& info);
+
   Napi::Value call(const Napi::CallbackInfo& info);
 
+  Napi::Value callMany(const Napi::CallbackInfo& info);
+
+  Napi::Value cancelCall(const Napi::CallbackInfo& info);
+
+  Napi::Value prepare(const Napi::CallbackInfo& info);
+
+  Napi::Value postPrepared(const Napi::CallbackInfo& info);
+
+  Napi::Value setPrepared(const Napi::CallbackInfo& info);
+
   Napi::Value genArray(const Napi::CallbackInfo& info);
 
   Napi::Value getSocket(const Napi::CallbackInfo& info);
 
+  Napi::Value getQueueStats(const Napi::CallbackInfo& info);
+
+  Napi::Value pendingCalls(const Napi::CallbackInfo& info);
+
+  Napi::Value peek(const Napi::CallbackInfo& info);
+
  private:
   ClientNative* thisClient = nullptr;
+  // identify handlers and methods of this agent in shared connection
+  uint32_t ownerId;
+  // id in uri of this agent, shareConnection only
+  std::string clientId;
+  bool shared = false;
+  bool started = false;
 };
 
 class NativeReply {
@@ -143,11 +649,12 @@ class NativeReply {
   static napi_value newInstance(napi_env env, napi_callback_info cbinfo);
 
   static napi_value createObject(napi_env env,
-                                 std::shared_ptr<flora::Reply>& reply);
+                                 std::shared_ptr<flora::Reply>& reply,
+                                 uint32_t encodeFlags);
 
   static void objectFinalize(napi_env env, void* data, void* hint);
 
-  explicit NativeReply(std::shared_ptr<flora::Reply>& r) : reply(r) {
+  NativeReply() : encodeFlags(0) {
   }
 
  public:
@@ -176,7 +683,10 @@ class NativeReply {
                                      NapiCallbackFunc cb);
 
  private:
-  static napi_ref replyConstructor;
+  // one per js thread, addon initialized again by each worker
+  static thread_local napi_ref replyConstructor;
 
+  // released on end, flora::Reply not needed any more
   std::shared_ptr<flora::Reply> reply;
+  uint32_t encodeFlags;
 };
@@ -0,0 +1,106 @@
+#include "flat-msg.h"
+#include "shm-binary.h"
+
+using namespace std;
+using namespace Napi;
+
+static bool flattenMembers(shared_ptr<Caps>& msg, FlatMsg& flat,
+                           std::string& str) {
+  size_t arr = flat.values.size();
+  flat.values.emplace_back();
+  flat.values[arr].type = FLAT_TYPE_ARRAY;
+  uint32_t count = 0;
+  int32_t iv;
+  int64_t lv;
+  float fv;
+  double dv;
+  shared_ptr<Caps> cv;
+
+  while (true) {
+    int32_t mtp = msg->next_type();
+    if (mtp == CAPS_ERR_EOO)
+      break;
+    FlatValue v;
+    switch (mtp) {
+      case CAPS_MEMBER_TYPE_INTEGER:
+        msg->read(iv);
+        v.type = FLAT_TYPE_NUMBER;
+        v.num = iv;
+        break;
+      case CAPS_MEMBER_TYPE_LONG:
+        msg->read(lv);
+        v.type = FLAT_TYPE_NUMBER;
+        v.num = lv;
+        break;
+      case CAPS_MEMBER_TYPE_FLOAT:
+        msg->read(fv);
+        v.type = FLAT_TYPE_NUMBER;
+        v.num = fv;
+        break;
+      case CAPS_MEMBER_TYPE_DOUBLE:
+        msg->read(dv);
+        v.type = FLAT_TYPE_NUMBER;
+        v.num = dv;
+        break;
+      case CAPS_MEMBER_TYPE_STRING:
+        msg->read_string(str);
+        v.type = FLAT_TYPE_STRING;
+        v.offset = flat.bytes.size();
+        v.size = str.length();
+        flat.bytes.append(str);
+        break;
+      case CAPS_MEMBER_TYPE_OBJECT:
+        msg->read(cv);
+        // shared memory binary descriptors are objects too
+        if (cv.get() == nullptr || isShmBinary(cv) ||
+            !flattenMembers(cv, flat, str))
+          return false;
+        ++count;
+        continue;
+      case CAPS_MEMBER_TYPE_VOID:
+        msg->read();
+        v.type = FLAT_TYPE_VOID;
+        break;
+      default:
+        return false;
+    }
+    flat.values.push_back(v);
+    ++count;
+  }
+  flat.values[arr].size = count;
+  return true;
+}
+
+bool flattenCaps(shared_ptr<Caps>& msg, FlatMsg& flat) {
+  if (msg.get() == nullptr)
+    return false;
+  std::string str;
+  bool r = flattenMembers(msg, flat, str);
+  msg->rewind();
+  return r;
+}
+
+static Napi::Value genJSValueByFlat(Napi::Env& env, const FlatMsg& flat,
+                                    size_t& idx) {
+  const FlatValue& v = flat.values[idx++];
+  switch (v.type) {
+    case FLAT_TYPE_NUMBER:
+      return Number::New(env, v.num);
+    case FLAT_TYPE_STRING:
+      return String::New(env, flat.bytes.data() + v.offset, v.size);
+    case FLAT_TYPE_ARRAY: {
+      Array arr = Array::New(env, v.size);
+      for (uint32_t i = 0; i < v.size; ++i)
+        arr[i] = genJSValueByFlat(env, flat, idx);
+      return arr;
+    }
+  }
+  return env.Undefined();
+}
+
+Napi::Value genJSArrayByFlat(Napi::Env env, const FlatMsg& flat) {
+  size_t idx = 0;
+  if (flat.values.empty())
+    return env.Undefined();
+  return genJSValueByFlat(env, flat, idx);
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <stdint.h>
+#include <memory>
+#include <string>
+#include <vector>
+#include "napi.h"
+#include "caps.h"
+
+#define FLAT_TYPE_NUMBER 0
+#define FLAT_TYPE_STRING 1
+#define FLAT_TYPE_ARRAY 2
+#define FLAT_TYPE_VOID 3
+
+class FlatValue {
+ public:
+  uint32_t type;
+  // FLAT_TYPE_STRING: utf8 bytes in FlatMsg::bytes
+  // FLAT_TYPE_ARRAY: count of members, following this value in order
+  uint32_t size = 0;
+  // FLAT_TYPE_STRING: offset in FlatMsg::bytes
+  uint32_t offset = 0;
+  double num = 0;
+};
+
+// caps decoded on flora thread, js thread only creates js values from it.
+// values in preorder, values[0] is the top level array
+class FlatMsg {
+ public:
+  std::vector<FlatValue> values;
+  std::string bytes;
+};
+
+// invoked on flora thread, msg rewound after read.
+// returns false if msg has binary members, left for js thread, which
+// borrows them from msg without copies
+bool flattenCaps(std::shared_ptr<Caps>& msg, FlatMsg& flat);
+
+Napi::Value genJSArrayByFlat(Napi::Env env, const FlatMsg& flat);
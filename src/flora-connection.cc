@@ -0,0 +1,193 @@
+#include "flora-connection.h"
+
+using namespace std;
+using namespace flora;
+
+// shared connections by key, dispatcher uri without client id.
+// entries removed when connection closed
+static mutex registryMutex;
+static map<string, weak_ptr<FloraConnection>> registry;
+
+shared_ptr<FloraConnection> FloraConnection::acquire(
+    const string& key, bool share, void* owner,
+    const ConfigureFunc& configure) {
+  lock_guard<std::mutex> locker(registryMutex);
+  shared_ptr<FloraConnection> conn;
+  if (share) {
+    auto it = registry.find(key);
+    if (it != registry.end())
+      conn = it->second.lock();
+  }
+  if (conn == nullptr) {
+    conn = make_shared<FloraConnection>();
+    conn->key = key;
+    conn->shared = share;
+    configure(*conn);
+    if (share)
+      registry[key] = conn;
+  }
+  conn->owners.insert(owner);
+  return conn;
+}
+
+shared_ptr<Caps> FloraConnection::cloneCaps(shared_ptr<Caps>& msg) {
+  int32_t size = msg->serialize(nullptr, 0);
+  if (size <= 0)
+    return nullptr;
+  vector<uint8_t> buf(size);
+  if (msg->serialize(buf.data(), size) != size)
+    return nullptr;
+  shared_ptr<Caps> copy;
+  if (Caps::parse(buf.data(), size, copy, true) != CAPS_SUCCESS)
+    return nullptr;
+  return copy;
+}
+
+void FloraConnection::start() {
+  lock_guard<std::mutex> locker(this->mutex);
+  if (started || closed)
+    return;
+  agent.start();
+  started = true;
+}
+
+void FloraConnection::release(void* owner) {
+  bool last;
+  {
+    lock_guard<std::mutex> registryLocker(registryMutex);
+    if (owners.erase(owner) == 0)
+      return;
+    last = owners.empty();
+    // not shared with later acquirers, even while agent still closing
+    if (last && shared) {
+      auto it = registry.find(key);
+      if (it != registry.end() && it->second.lock().get() == this)
+        registry.erase(it);
+    }
+  }
+  unique_lock<std::mutex> locker(this->mutex);
+  if (last) {
+    closed = true;
+    bool needClose = started;
+    // agent.close waits flora thread, which may be blocked on this->mutex
+    // in callbacks. close agent without any lock held
+    locker.unlock();
+    if (needClose)
+      agent.close();
+    locker.lock();
+    // subscriber callbacks never invoked after agent closed
+    topics.clear();
+    methods.clear();
+    return;
+  }
+  vector<string> names;
+  for (auto it = topics.begin(); it != topics.end(); ++it)
+    names.push_back(it->first);
+  for (size_t i = 0; i < names.size(); ++i)
+    removeSubscriber(names[i], owner);
+  auto mit = methods.begin();
+  while (mit != methods.end()) {
+    if (mit->second == owner) {
+      agent.remove_method(mit->first.c_str());
+      mit = methods.erase(mit);
+    } else {
+      ++mit;
+    }
+  }
+}
+
+bool FloraConnection::subscribe(const string& name, void* owner,
+                                SubscribeCallback cb) {
+  lock_guard<std::mutex> locker(this->mutex);
+  if (closed)
+    return false;
+  shared_ptr<Topic>& topic = topics[name];
+  bool first = topic == nullptr;
+  if (first)
+    topic = make_shared<Topic>();
+  shared_ptr<const Subscribers> cur = atomic_load(&topic->current);
+  shared_ptr<Subscribers> subs =
+      cur ? make_shared<Subscribers>(*cur) : make_shared<Subscribers>();
+  subs->push_back(Subscriber{ owner, cb });
+  atomic_store(&topic->current, shared_ptr<const Subscribers>(subs));
+  if (first) {
+    shared_ptr<Topic> t = topic;
+    agent.subscribe(name.c_str(), [t](const char* name, shared_ptr<Caps>& msg,
+                                      uint32_t type) {
+      FloraConnection::dispatch(t, name, msg, type);
+    });
+  }
+  return first;
+}
+
+void FloraConnection::unsubscribe(const string& name, void* owner) {
+  lock_guard<std::mutex> locker(this->mutex);
+  removeSubscriber(name, owner);
+}
+
+// mutex locked by caller
+void FloraConnection::removeSubscriber(const string& name, void* owner) {
+  auto it = topics.find(name);
+  if (it == topics.end())
+    return;
+  shared_ptr<const Subscribers> cur = atomic_load(&it->second->current);
+  shared_ptr<Subscribers> subs = make_shared<Subscribers>();
+  bool removed = false;
+  for (size_t i = 0; i < cur->size(); ++i) {
+    if ((*cur)[i].owner == owner)
+      removed = true;
+    else
+      subs->push_back((*cur)[i]);
+  }
+  if (!removed)
+    return;
+  if (subs->empty()) {
+    agent.unsubscribe(name.c_str());
+    topics.erase(it);
+    return;
+  }
+  atomic_store(&it->second->current, shared_ptr<const Subscribers>(subs));
+}
+
+bool FloraConnection::declareMethod(const string& name, void* owner,
+                                    DeclareMethodCallback cb) {
+  lock_guard<std::mutex> locker(this->mutex);
+  if (closed || methods.find(name) != methods.end())
+    return false;
+  methods[name] = owner;
+  agent.declare_method(name.c_str(), cb);
+  return true;
+}
+
+void FloraConnection::removeMethod(const string& name, void* owner) {
+  lock_guard<std::mutex> locker(this->mutex);
+  auto it = methods.find(name);
+  if (it == methods.end() || it->second != owner)
+    return;
+  agent.remove_method(name.c_str());
+  methods.erase(it);
+}
+
+// invoked on flora thread
+void FloraConnection::dispatch(const shared_ptr<Topic>& topic,
+                               const char* name, shared_ptr<Caps>& msg,
+                               uint32_t type) {
+  shared_ptr<const Subscribers> subs = atomic_load(&topic->current);
+  if (!subs || subs->empty())
+    return;
+  if (subs->size() == 1) {
+    (*subs)[0].cb(name, msg, type);
+    return;
+  }
+  // read position of caps not thread safe, each js thread reads own copy.
+  // copies made before any subscriber reads msg
+  vector<shared_ptr<Caps>> copies(subs->size());
+  copies[0] = msg;
+  size_t i;
+  for (i = 1; i < copies.size(); ++i)
+    copies[i] = cloneCaps(msg);
+  for (i = 0; i < copies.size(); ++i) {
+    if (copies[i])
+      (*subs)[i].cb(name, copies[i], type);
+  }
+}
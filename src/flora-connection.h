@@ -0,0 +1,90 @@
+#pragma once
+
+#include <stdint.h>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <vector>
+#include "flora-agent.h"
+
+// flora connection used by agents of one or more js threads.
+// flora allows one subscription of a msg name and one declaration of a
+// method name per connection, msgs fanned out to all subscribers here.
+// thread safe, subscriber callbacks invoked on flora thread
+class FloraConnection {
+ public:
+  typedef std::function<void(FloraConnection&)> ConfigureFunc;
+
+  // connection shared by key if share is true, private otherwise.
+  // configure invoked only if connection created by this call, before it
+  // could be acquired by other threads
+  static std::shared_ptr<FloraConnection> acquire(
+      const std::string& key, bool share, void* owner,
+      const ConfigureFunc& configure);
+
+  // copy of msg with its own read position, for msgs read by more than
+  // one js thread
+  static std::shared_ptr<Caps> cloneCaps(std::shared_ptr<Caps>& msg);
+
+  // start agent once, later calls ignored
+  void start();
+
+  // remove subscriptions and methods of owner, agent closed when no
+  // owner left. owner released twice ignored
+  void release(void* owner);
+
+  // true if agent subscribed name, flora replays persist msg of name
+  // to subscribers then. later subscribers of a name get no replay
+  bool subscribe(const std::string& name, void* owner,
+                 flora::SubscribeCallback cb);
+
+  void unsubscribe(const std::string& name, void* owner);
+
+  // false if method declared by other owner
+  bool declareMethod(const std::string& name, void* owner,
+                     flora::DeclareMethodCallback cb);
+
+  void removeMethod(const std::string& name, void* owner);
+
+  flora::Agent agent;
+  // options agent configured with, set by creator
+  std::string clientId;
+  uint32_t reconnInterval = 0;
+  uint32_t bufsize = 0;
+  uint32_t beepInterval = 0;
+  uint32_t norespTimeout = 0;
+
+ private:
+  class Subscriber {
+   public:
+    void* owner;
+    flora::SubscribeCallback cb;
+  };
+
+  typedef std::vector<Subscriber> Subscribers;
+
+  // replaced as a whole, flora thread reads snapshot without lock
+  class Topic {
+   public:
+    std::shared_ptr<const Subscribers> current;
+  };
+
+  static void dispatch(const std::shared_ptr<Topic>& topic, const char* name,
+                       std::shared_ptr<Caps>& msg, uint32_t type);
+
+  void removeSubscriber(const std::string& name, void* owner);
+
+  std::mutex mutex;
+  std::map<std::string, std::shared_ptr<Topic>> topics;
+  // owner of each method declared
+  std::map<std::string, void*> methods;
+  // guarded by registry mutex
+  std::set<void*> owners;
+  std::string key;
+  bool shared = false;
+  bool started = false;
+  bool closed = false;
+};
@@ -0,0 +1,232 @@
+#include "msg-filter.h"
+
+using namespace std;
+using namespace Napi;
+
+static bool parseFilterType(const std::string& name, uint32_t& type) {
+  if (name == "number")
+    type = FILTER_TYPE_NUMBER;
+  else if (name == "string")
+    type = FILTER_TYPE_STRING;
+  else if (name == "object")
+    type = FILTER_TYPE_OBJECT;
+  else if (name == "binary")
+    type = FILTER_TYPE_BINARY;
+  else if (name == "undefined")
+    type = FILTER_TYPE_VOID;
+  else
+    return false;
+  return true;
+}
+
+static bool parseFilterValue(const Napi::Value& v, MsgFilterValue& fv) {
+  if (v.IsNumber()) {
+    fv.type = FILTER_TYPE_NUMBER;
+    fv.num = v.As<Number>().DoubleValue();
+  } else if (v.IsString()) {
+    fv.type = FILTER_TYPE_STRING;
+    fv.str = v.As<String>();
+  } else if (v.IsNull() || v.IsUndefined()) {
+    fv.type = FILTER_TYPE_VOID;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+static bool parseFilterCond(const Napi::Value& spec, MsgFilterCond& cond) {
+  if (!spec.IsObject())
+    return false;
+  Object obj = spec.As<Object>();
+  Napi::Value v = obj.Get("index");
+  if (v.IsNumber()) {
+    cond.path.push_back(v.As<Number>().Uint32Value());
+  } else if (v.IsArray()) {
+    Array arr = v.As<Array>();
+    uint32_t len = arr.Length();
+    for (uint32_t i = 0; i < len; ++i) {
+      Napi::Value e = arr.Get(i);
+      if (!e.IsNumber())
+        return false;
+      cond.path.push_back(e.As<Number>().Uint32Value());
+    }
+  }
+  if (cond.path.empty())
+    return false;
+
+  v = obj.Get("type");
+  if (v.IsString()) {
+    if (!parseFilterType(v.As<String>(), cond.type))
+      return false;
+  } else if (!v.IsUndefined()) {
+    return false;
+  }
+
+  if (obj.Has("equals")) {
+    v = obj.Get("equals");
+    if (v.IsArray()) {
+      Array arr = v.As<Array>();
+      uint32_t len = arr.Length();
+      cond.values.resize(len);
+      for (uint32_t i = 0; i < len; ++i) {
+        if (!parseFilterValue(arr.Get(i), cond.values[i]))
+          return false;
+      }
+    } else {
+      cond.values.resize(1);
+      if (!parseFilterValue(v, cond.values[0]))
+        return false;
+    }
+  }
+  return true;
+}
+
+bool parseMsgFilter(Napi::Env env, const Napi::Value& spec,
+                    shared_ptr<MsgFilter>& filter) {
+  filter = make_shared<MsgFilter>();
+  bool r = true;
+  if (spec.IsArray()) {
+    Array arr = spec.As<Array>();
+    uint32_t len = arr.Length();
+    filter->resize(len);
+    for (uint32_t i = 0; i < len && r; ++i) {
+      r = parseFilterCond(arr.Get(i), (*filter)[i]);
+    }
+  } else {
+    filter->resize(1);
+    r = parseFilterCond(spec, (*filter)[0]);
+  }
+  if (!r) {
+    filter.reset();
+    TypeError::New(env, "invalid msg filter").ThrowAsJavaScriptException();
+  }
+  return r;
+}
+
+static uint32_t filterTypeOf(int32_t capsType) {
+  switch (capsType) {
+    case CAPS_MEMBER_TYPE_INTEGER:
+    case CAPS_MEMBER_TYPE_LONG:
+    case CAPS_MEMBER_TYPE_FLOAT:
+    case CAPS_MEMBER_TYPE_DOUBLE:
+      return FILTER_TYPE_NUMBER;
+    case CAPS_MEMBER_TYPE_STRING:
+      return FILTER_TYPE_STRING;
+    case CAPS_MEMBER_TYPE_OBJECT:
+      return FILTER_TYPE_OBJECT;
+    case CAPS_MEMBER_TYPE_BINARY:
+      return FILTER_TYPE_BINARY;
+  }
+  return FILTER_TYPE_VOID;
+}
+
+static bool skipMember(shared_ptr<Caps>& caps) {
+  int32_t iv;
+  int64_t lv;
+  float fv;
+  double dv;
+  std::string sv;
+  const void* bv;
+  uint32_t blen;
+  shared_ptr<Caps> cv;
+
+  switch (caps->next_type()) {
+    case CAPS_ERR_EOO:
+      return false;
+    case CAPS_MEMBER_TYPE_INTEGER:
+      return caps->read(iv) == CAPS_SUCCESS;
+    case CAPS_MEMBER_TYPE_LONG:
+      return caps->read(lv) == CAPS_SUCCESS;
+    case CAPS_MEMBER_TYPE_FLOAT:
+      return caps->read(fv) == CAPS_SUCCESS;
+    case CAPS_MEMBER_TYPE_DOUBLE:
+      return caps->read(dv) == CAPS_SUCCESS;
+    case CAPS_MEMBER_TYPE_STRING:
+      return caps->read_string(sv) == CAPS_SUCCESS;
+    case CAPS_MEMBER_TYPE_BINARY:
+      return caps->read(bv, blen) == CAPS_SUCCESS;
+    case CAPS_MEMBER_TYPE_OBJECT:
+      return caps->read(cv) == CAPS_SUCCESS;
+  }
+  return caps->read() == CAPS_SUCCESS;
+}
+
+// member read next is compared with cond
+static bool matchMember(const MsgFilterCond& cond, shared_ptr<Caps>& caps) {
+  int32_t ctp = caps->next_type();
+  uint32_t tp = filterTypeOf(ctp);
+  if (cond.type != FILTER_TYPE_ANY && cond.type != tp)
+    return false;
+  if (cond.values.empty())
+    return true;
+
+  double num = 0;
+  std::string str;
+  if (tp == FILTER_TYPE_NUMBER) {
+    int32_t iv;
+    int64_t lv;
+    float fv;
+    switch (ctp) {
+      case CAPS_MEMBER_TYPE_INTEGER:
+        caps->read(iv);
+        num = iv;
+        break;
+      case CAPS_MEMBER_TYPE_LONG:
+        caps->read(lv);
+        num = lv;
+        break;
+      case CAPS_MEMBER_TYPE_FLOAT:
+        caps->read(fv);
+        num = fv;
+        break;
+      default:
+        caps->read(num);
+        break;
+    }
+  } else if (tp == FILTER_TYPE_STRING) {
+    caps->read_string(str);
+  } else if (tp != FILTER_TYPE_VOID) {
+    // objects and binaries only match by type
+    return false;
+  }
+
+  for (auto it = cond.values.begin(); it != cond.values.end(); ++it) {
+    if (it->type != tp)
+      continue;
+    if (tp == FILTER_TYPE_VOID || (tp == FILTER_TYPE_NUMBER && it->num == num) ||
+        (tp == FILTER_TYPE_STRING && it->str == str))
+      return true;
+  }
+  return false;
+}
+
+static bool matchCondAt(const MsgFilterCond& cond, size_t level,
+                        shared_ptr<Caps>& caps) {
+  bool r = false;
+  uint32_t i;
+  for (i = 0; i < cond.path[level]; ++i) {
+    if (!skipMember(caps))
+      break;
+  }
+  if (i == cond.path[level] && caps->next_type() != CAPS_ERR_EOO) {
+    if (level + 1 == cond.path.size()) {
+      r = matchMember(cond, caps);
+    } else if (caps->next_type() == CAPS_MEMBER_TYPE_OBJECT) {
+      shared_ptr<Caps> sub;
+      if (caps->read(sub) == CAPS_SUCCESS && sub.get())
+        r = matchCondAt(cond, level + 1, sub);
+    }
+  }
+  caps->rewind();
+  return r;
+}
+
+bool matchMsgFilter(const MsgFilter& filter, shared_ptr<Caps>& msg) {
+  if (msg.get() == nullptr)
+    return false;
+  for (auto it = filter.begin(); it != filter.end(); ++it) {
+    if (!matchCondAt(*it, 0, msg))
+      return false;
+  }
+  return true;
+}
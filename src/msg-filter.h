@@ -0,0 +1,44 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+#include "napi.h"
+#include "caps.h"
+
+#define FILTER_TYPE_ANY 0
+#define FILTER_TYPE_NUMBER 1
+#define FILTER_TYPE_STRING 2
+#define FILTER_TYPE_OBJECT 3
+#define FILTER_TYPE_BINARY 4
+#define FILTER_TYPE_VOID 5
+
+class MsgFilterValue {
+ public:
+  uint32_t type;
+  double num = 0;
+  std::string str;
+};
+
+// member at path must be of type, and equal to one of values if any
+class MsgFilterCond {
+ public:
+  // member index of each nesting level
+  std::vector<uint32_t> path;
+  uint32_t type = FILTER_TYPE_ANY;
+  std::vector<MsgFilterValue> values;
+};
+
+// all conditions must match.
+// immutable after parsed, shared with flora thread
+typedef std::vector<MsgFilterCond> MsgFilter;
+
+// parse js filter spec:
+// { index: number|number[], type?: string, equals?: any|any[] }
+// or array of it
+// returns false and throws js exception if spec invalid
+bool parseMsgFilter(Napi::Env env, const Napi::Value& spec,
+                    std::shared_ptr<MsgFilter>& filter);
+
+// invoked on flora thread, caps read position rewound before return
+bool matchMsgFilter(const MsgFilter& filter, std::shared_ptr<Caps>& msg);
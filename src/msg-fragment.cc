@@ -0,0 +1,164 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <atomic>
+#include <random>
+#include "msg-fragment.h"
+
+using namespace std;
+
+void BufferPool::get(vector<uint8_t>& buf) {
+  lock_guard<std::mutex> locker(this->mutex);
+  if (buffers.empty())
+    return;
+  buf.swap(buffers.back());
+  buffers.pop_back();
+}
+
+void BufferPool::put(vector<uint8_t>& buf) {
+  lock_guard<std::mutex> locker(this->mutex);
+  if (buffers.size() >= MAX_POOLED_BUFFERS)
+    return;
+  buf.clear();
+  buffers.emplace_back();
+  buffers.back().swap(buf);
+}
+
+static std::atomic<uint32_t> lastFragmentId{ 0 };
+
+// pid alone collides with senders of other hosts over tcp
+static const string& senderIdentity() {
+  static const string identity = [] {
+    random_device rd;
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%d:%08x%08x", (int)getpid(), rd(), rd());
+    return string(buf);
+  }();
+  return identity;
+}
+
+bool splitMsg(shared_ptr<Caps>& msg, uint32_t fragSize, BufferPool& pool,
+              vector<shared_ptr<Caps>>& fragments) {
+  int32_t size = msg->serialize(nullptr, 0);
+  if (size <= 0 || fragSize == 0)
+    return false;
+  vector<uint8_t> buf;
+  pool.get(buf);
+  buf.resize(size);
+  if (msg->serialize(buf.data(), size) != size) {
+    pool.put(buf);
+    return false;
+  }
+  // unique in all senders of the msg name
+  string id = senderIdentity() + ":" + to_string(++lastFragmentId);
+  uint32_t count = (size + fragSize - 1) / fragSize;
+  uint32_t i;
+  for (i = 0; i < count; ++i) {
+    shared_ptr<Caps> frag = Caps::new_instance();
+    uint32_t offset = i * fragSize;
+    uint32_t len = size - offset < fragSize ? size - offset : fragSize;
+    frag->write(FRAGMENT_MAGIC);
+    frag->write(id);
+    frag->write(i);
+    frag->write(count);
+    frag->write(buf.data() + offset, len);
+    fragments.push_back(frag);
+  }
+  pool.put(buf);
+  return true;
+}
+
+shared_ptr<Caps> abortFragment(shared_ptr<Caps>& fragment) {
+  string magic;
+  string id;
+  uint32_t index;
+  uint32_t count;
+  bool r = fragment->read_string(magic) == CAPS_SUCCESS &&
+           magic == FRAGMENT_MAGIC &&
+           fragment->read_string(id) == CAPS_SUCCESS &&
+           fragment->read(index) == CAPS_SUCCESS &&
+           fragment->read(count) == CAPS_SUCCESS;
+  fragment->rewind();
+  if (!r)
+    return nullptr;
+  shared_ptr<Caps> abort = Caps::new_instance();
+  abort->write(FRAGMENT_MAGIC);
+  abort->write(id);
+  abort->write(count);
+  abort->write(count);
+  return abort;
+}
+
+bool FragmentAssembler::feed(const char* name, shared_ptr<Caps>& msg) {
+  if (msg.get() == nullptr || msg->next_type() != CAPS_MEMBER_TYPE_STRING)
+    return true;
+  // every msg checked here, magic compared in place without copy
+  const char* magic = nullptr;
+  string id;
+  uint32_t index;
+  uint32_t count;
+  const void* data;
+  uint32_t length;
+  if (msg->read(magic) != CAPS_SUCCESS || magic == nullptr ||
+      strcmp(magic, FRAGMENT_MAGIC) != 0) {
+    msg->rewind();
+    return true;
+  }
+  bool valid = msg->read_string(id) == CAPS_SUCCESS &&
+               msg->read(index) == CAPS_SUCCESS &&
+               msg->read(count) == CAPS_SUCCESS;
+  bool aborted = valid && index == count;
+  if (valid && !aborted)
+    valid = msg->read(data, length) == CAPS_SUCCESS && index < count;
+  msg->rewind();
+  if (!valid)
+    return false;
+
+  string key = string(name) + '\0' + id;
+  lock_guard<std::mutex> locker(this->mutex);
+  auto it = assemblies.find(key);
+  if (aborted) {
+    if (it != assemblies.end()) {
+      pool.put(it->second.data);
+      assemblies.erase(it);
+    }
+    return false;
+  }
+  if (it == assemblies.end()) {
+    // fragments of one msg sent in order, missing head means lost
+    if (index != 0)
+      return false;
+    if (assemblies.size() >= MAX_PENDING_ASSEMBLIES) {
+      auto oldest = assemblies.begin();
+      for (auto ait = assemblies.begin(); ait != assemblies.end(); ++ait) {
+        if (ait->second.seq < oldest->second.seq)
+          oldest = ait;
+      }
+      pool.put(oldest->second.data);
+      assemblies.erase(oldest);
+    }
+    it = assemblies.insert(make_pair(key, Assembly())).first;
+    pool.get(it->second.data);
+    it->second.count = count;
+    it->second.seq = ++lastSeq;
+  }
+  Assembly& as = it->second;
+  if (index != as.next || count != as.count) {
+    pool.put(as.data);
+    assemblies.erase(it);
+    return false;
+  }
+  const uint8_t* bytes = reinterpret_cast<const uint8_t*>(data);
+  as.data.insert(as.data.end(), bytes, bytes + length);
+  ++as.next;
+  if (as.next < as.count)
+    return false;
+  shared_ptr<Caps> whole;
+  int32_t r = Caps::parse(as.data.data(), as.data.size(), whole, true);
+  pool.put(as.data);
+  assemblies.erase(it);
+  if (r != CAPS_SUCCESS)
+    return false;
+  msg = whole;
+  return true;
+}
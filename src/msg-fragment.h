@@ -0,0 +1,68 @@
+#pragma once
+
+#include <stdint.h>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "caps.h"
+
+// msgs larger than agent bufsize posted as fragments:
+// [ FRAGMENT_MAGIC, id, index, count, binary ]
+// with same msg name, and reassembled by receiver before dispatch.
+// [ FRAGMENT_MAGIC, id, count, count ] posted if sender failed posting
+// the rest, receiver drops fragments of id received
+#define FRAGMENT_MAGIC "\001flora-fragment"
+// bytes of msg buffer reserved for msg name and fragment header
+#define FRAGMENT_OVERHEAD 256
+// partially received msgs kept at most, oldest dropped
+#define MAX_PENDING_ASSEMBLIES 16
+// serialize buffers kept for reuse
+#define MAX_POOLED_BUFFERS 4
+
+// thread safe
+class BufferPool {
+ public:
+  // buf is empty or a pooled buffer
+  void get(std::vector<uint8_t>& buf);
+
+  void put(std::vector<uint8_t>& buf);
+
+ private:
+  std::mutex mutex;
+  std::vector<std::vector<uint8_t>> buffers;
+};
+
+// split msg serialized to fragments of at most fragSize bytes data
+bool splitMsg(std::shared_ptr<Caps>& msg, uint32_t fragSize, BufferPool& pool,
+              std::vector<std::shared_ptr<Caps>>& fragments);
+
+// abort marker of msg fragment belongs to, null if not a fragment
+std::shared_ptr<Caps> abortFragment(std::shared_ptr<Caps>& fragment);
+
+// invoked on flora thread
+class FragmentAssembler {
+ public:
+  explicit FragmentAssembler(BufferPool& p) : pool(p) {
+  }
+
+  // returns false if msg is fragment of incomplete msg.
+  // msg replaced by reassembled msg if it is the last fragment
+  bool feed(const char* name, std::shared_ptr<Caps>& msg);
+
+ private:
+  class Assembly {
+   public:
+    std::vector<uint8_t> data;
+    uint32_t next = 0;
+    uint32_t count = 0;
+    uint64_t seq = 0;
+  };
+
+  BufferPool& pool;
+  std::mutex mutex;
+  // by msg name and fragment id
+  std::map<std::string, Assembly> assemblies;
+  uint64_t lastSeq = 0;
+};
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+
+// native objects wrapped by short lived js objects kept at most
+#define MAX_POOLED_OBJECTS 256
+
+// free list of objects released by js finalizers, taken again instead of
+// new/delete. not thread safe, one pool per js thread.
+// objects must be reset by owner before put
+template <typename T>
+class ObjectPool {
+ public:
+  ~ObjectPool() {
+    for (auto it = freeList.begin(); it != freeList.end(); ++it)
+      delete *it;
+  }
+
+  T* get() {
+    if (freeList.empty()) {
+      ++misses;
+      return new T();
+    }
+    ++hits;
+    T* obj = freeList.back();
+    freeList.pop_back();
+    return obj;
+  }
+
+  void put(T* obj) {
+    if (freeList.size() >= MAX_POOLED_OBJECTS) {
+      delete obj;
+      return;
+    }
+    freeList.push_back(obj);
+  }
+
+  uint64_t hits = 0;
+  uint64_t misses = 0;
+
+ private:
+  std::vector<T*> freeList;
+};
@@ -0,0 +1,262 @@
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+#include <list>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#define CACHE_LINE_SIZE 64
+
+// bounded lock-free ring, exactly one producer thread and one consumer thread.
+// capacity is rounded up to power of 2
+template <typename T>
+class SpscRing {
+ public:
+  void init(uint32_t cap) {
+    uint32_t c = 1;
+    while (c < cap)
+      c <<= 1;
+    slots.clear();
+    slots.resize(c);
+    mask = c - 1;
+    head.store(0, std::memory_order_relaxed);
+    tail.store(0, std::memory_order_relaxed);
+  }
+
+  // v is untouched if ring is full
+  bool push(T&& v) {
+    uint32_t t = tail.load(std::memory_order_relaxed);
+    if (t - head.load(std::memory_order_acquire) > mask)
+      return false;
+    slots[t & mask] = std::move(v);
+    tail.store(t + 1, std::memory_order_release);
+    return true;
+  }
+
+  bool pop(T& v) {
+    uint32_t h = head.load(std::memory_order_relaxed);
+    if (h == tail.load(std::memory_order_acquire))
+      return false;
+    v = std::move(slots[h & mask]);
+    head.store(h + 1, std::memory_order_release);
+    return true;
+  }
+
+  uint32_t size() const {
+    return tail.load(std::memory_order_acquire) -
+           head.load(std::memory_order_acquire);
+  }
+
+  uint32_t capacity() const {
+    return mask + 1;
+  }
+
+ private:
+  std::vector<T> slots;
+  uint32_t mask = 0;
+  // keep producer and consumer indices on different cache lines
+  char pad0[CACHE_LINE_SIZE];
+  std::atomic<uint32_t> head{ 0 };
+  char pad1[CACHE_LINE_SIZE - sizeof(std::atomic<uint32_t>)];
+  std::atomic<uint32_t> tail{ 0 };
+  char pad2[CACHE_LINE_SIZE - sizeof(std::atomic<uint32_t>)];
+};
+
+// queue of callbacks handed from flora client thread to js thread.
+// fast path is the SpscRing, when ring is full items spill to a locked list,
+// and ring is not used again until consumer took the spilled items, so
+// FIFO order is kept.
+template <typename T>
+class PendingQueue {
+ public:
+  void init(uint32_t cap) {
+    ring.init(cap);
+  }
+
+  // producer side
+  // returns true if consumer need to be waken up
+  bool push(T&& v) {
+    if (spillCount.load() > 0 || !ring.push(std::move(v))) {
+      std::lock_guard<std::mutex> locker(spillMutex);
+      spill.push_back(std::move(v));
+      spillCount.fetch_add(1);
+      spilled.fetch_add(1, std::memory_order_relaxed);
+    } else {
+      ringPushed.fetch_add(1, std::memory_order_relaxed);
+    }
+    return !wakeupPending.exchange(true);
+  }
+
+  // consumer side
+  // must be invoked before pop items, wake up requests after this point
+  // will invoke consumer again
+  void beginDrain() {
+    wakeupPending.store(false);
+  }
+
+  bool pop(T& v) {
+    if (!draining.empty()) {
+      v = std::move(draining.front());
+      draining.pop_front();
+      return true;
+    }
+    if (ring.pop(v))
+      return true;
+    if (spillCount.load() == 0)
+      return false;
+    spillMutex.lock();
+    draining.swap(spill);
+    spillCount.store(0);
+    spillMutex.unlock();
+    v = std::move(draining.front());
+    draining.pop_front();
+    return true;
+  }
+
+  uint32_t size() const {
+    return ring.size() + spillCount.load();
+  }
+
+  // items pushed to preallocated ring slots, and to allocated list nodes
+  uint32_t ringPushes() const {
+    return ringPushed.load(std::memory_order_relaxed);
+  }
+
+  uint32_t spills() const {
+    return spilled.load(std::memory_order_relaxed);
+  }
+
+ private:
+  SpscRing<T> ring;
+  std::atomic<bool> wakeupPending{ false };
+  std::atomic<uint32_t> spillCount{ 0 };
+  std::atomic<uint32_t> ringPushed{ 0 };
+  std::atomic<uint32_t> spilled{ 0 };
+  std::mutex spillMutex;
+  std::list<T> spill;
+  // spilled items taken by consumer, only accessed by consumer
+  std::list<T> draining;
+};
+
+// PendingQueue per priority lane, lane 0 is the highest.
+// consumer always pops from highest non empty lane, order kept within lane.
+// queues init with evictable have a second consumer, the producer evicting
+// items, so lanes are locked lists instead of SpscRing
+template <typename T, uint32_t N>
+class LanedQueue {
+ public:
+  void init(uint32_t cap, bool evictable = false) {
+    this->evictable = evictable;
+    if (evictable)
+      return;
+    for (uint32_t i = 0; i < N; ++i)
+      lanes[i].init(cap);
+  }
+
+  // producer side
+  // returns true if consumer need to be waken up
+  bool push(uint32_t lane, T&& v) {
+    if (lane >= N)
+      lane = N - 1;
+    if (evictable) {
+      std::lock_guard<std::mutex> locker(lockedMutex);
+      locked[lane].push_back(std::move(v));
+      lockedCount[lane].fetch_add(1);
+      lockedPushed.fetch_add(1, std::memory_order_relaxed);
+    } else {
+      lanes[lane].push(std::move(v));
+    }
+    return !wakeupPending.exchange(true);
+  }
+
+  // consumer side
+  void beginDrain() {
+    wakeupPending.store(false);
+    if (evictable)
+      return;
+    for (uint32_t i = 0; i < N; ++i)
+      lanes[i].beginDrain();
+  }
+
+  bool pop(T& v) {
+    uint32_t i;
+    if (evictable) {
+      std::lock_guard<std::mutex> locker(lockedMutex);
+      for (i = 0; i < N; ++i) {
+        if (!locked[i].empty()) {
+          v = std::move(locked[i].front());
+          locked[i].pop_front();
+          lockedCount[i].fetch_sub(1);
+          return true;
+        }
+      }
+      return false;
+    }
+    for (i = 0; i < N; ++i) {
+      if (lanes[i].pop(v))
+        return true;
+    }
+    return false;
+  }
+
+  // producer side, evictable queues only.
+  // takes oldest item of lowest non empty lane that is not pinned(item),
+  // pinned items keep their place
+  template <typename Pinned>
+  bool evictLowest(T& v, Pinned pinned) {
+    if (!evictable)
+      return false;
+    std::lock_guard<std::mutex> locker(lockedMutex);
+    for (uint32_t i = N; i > 0; --i) {
+      std::list<T>& lane = locked[i - 1];
+      for (auto it = lane.begin(); it != lane.end(); ++it) {
+        if (pinned(*it))
+          continue;
+        v = std::move(*it);
+        lane.erase(it);
+        lockedCount[i - 1].fetch_sub(1);
+        return true;
+      }
+    }
+    return false;
+  }
+
+  uint32_t size() const {
+    uint32_t r = 0;
+    for (uint32_t i = 0; i < N; ++i)
+      r += size(i);
+    return r;
+  }
+
+  uint32_t size(uint32_t lane) const {
+    if (evictable)
+      return lockedCount[lane].load();
+    return lanes[lane].size();
+  }
+
+  uint32_t ringPushes() const {
+    uint32_t r = 0;
+    for (uint32_t i = 0; i < N; ++i)
+      r += lanes[i].ringPushes();
+    return r;
+  }
+
+  // items of evictable queues always in allocated list nodes
+  uint32_t spills() const {
+    uint32_t r = lockedPushed.load(std::memory_order_relaxed);
+    for (uint32_t i = 0; i < N; ++i)
+      r += lanes[i].spills();
+    return r;
+  }
+
+ private:
+  PendingQueue<T> lanes[N];
+  bool evictable = false;
+  std::mutex lockedMutex;
+  std::list<T> locked[N];
+  std::atomic<uint32_t> lockedCount[N] = {};
+  std::atomic<uint32_t> lockedPushed{ 0 };
+  std::atomic<bool> wakeupPending{ false };
+};
@@ -0,0 +1,399 @@
+#include <fcntl.h>
+#include <pthread.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/vfs.h>
+#include <unistd.h>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <utility>
+#include "shm-binary.h"
+
+using namespace std;
+
+#if defined(__linux__) && defined(__NR_memfd_create)
+#define SHM_SUPPORTED
+#endif
+
+#ifdef SHM_SUPPORTED
+// not declared by older headers
+#ifndef MFD_CLOEXEC
+#define MFD_CLOEXEC 0x0001U
+#endif
+#ifndef MFD_ALLOW_SEALING
+#define MFD_ALLOW_SEALING 0x0002U
+#endif
+#ifndef F_ADD_SEALS
+#define F_ADD_SEALS 1033
+#define F_GET_SEALS 1034
+#endif
+#ifndef F_SEAL_SEAL
+#define F_SEAL_SEAL 0x0001
+#define F_SEAL_SHRINK 0x0002
+#define F_SEAL_GROW 0x0004
+#define F_SEAL_WRITE 0x0008
+#endif
+#ifndef TMPFS_MAGIC
+#define TMPFS_MAGIC 0x01021994
+#endif
+#define SHM_SEALS (F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE)
+#endif
+
+// walks members of msg and nested objects, fn invoked with each shm
+// descriptor until it returns false. large set if msg has copied binary
+// members not smaller than SHM_MIN_SIZE. msg rewound before return
+static bool walkShmBinaries(shared_ptr<Caps>& msg,
+                            const function<bool(shared_ptr<Caps>&)>& fn,
+                            bool& large) {
+  int32_t iv;
+  int64_t lv;
+  float fv;
+  double dv;
+  const char* sv;
+  const void* bv;
+  uint32_t length;
+  shared_ptr<Caps> cv;
+  bool r = true;
+  while (r) {
+    int32_t mtp = msg->next_type();
+    if (mtp == CAPS_ERR_EOO)
+      break;
+    switch (mtp) {
+      case CAPS_MEMBER_TYPE_INTEGER:
+        r = msg->read(iv) == CAPS_SUCCESS;
+        break;
+      case CAPS_MEMBER_TYPE_LONG:
+        r = msg->read(lv) == CAPS_SUCCESS;
+        break;
+      case CAPS_MEMBER_TYPE_FLOAT:
+        r = msg->read(fv) == CAPS_SUCCESS;
+        break;
+      case CAPS_MEMBER_TYPE_DOUBLE:
+        r = msg->read(dv) == CAPS_SUCCESS;
+        break;
+      case CAPS_MEMBER_TYPE_STRING:
+        r = msg->read(sv) == CAPS_SUCCESS;
+        break;
+      case CAPS_MEMBER_TYPE_BINARY:
+        r = msg->read(bv, length) == CAPS_SUCCESS;
+        if (r && length >= SHM_MIN_SIZE)
+          large = true;
+        break;
+      case CAPS_MEMBER_TYPE_OBJECT:
+        r = msg->read(cv) == CAPS_SUCCESS;
+        if (!r || cv.get() == nullptr)
+          break;
+        if (isShmBinary(cv))
+          r = fn(cv);
+        else
+          r = walkShmBinaries(cv, fn, large);
+        break;
+      case CAPS_MEMBER_TYPE_VOID:
+        r = msg->read() == CAPS_SUCCESS;
+        break;
+      default:
+        r = false;
+    }
+  }
+  msg->rewind();
+  return r;
+}
+
+static bool readShmDesc(shared_ptr<Caps>& obj, int32_t& pid, int32_t& fd,
+                        uint32_t& length, int64_t& ino) {
+  const char* magic = nullptr;
+  bool r = obj->read(magic) == CAPS_SUCCESS && magic != nullptr &&
+           strcmp(magic, SHM_MAGIC) == 0 && obj->read(pid) == CAPS_SUCCESS &&
+           obj->read(fd) == CAPS_SUCCESS &&
+           obj->read(length) == CAPS_SUCCESS && obj->read(ino) == CAPS_SUCCESS;
+  obj->rewind();
+  return r;
+}
+
+#ifdef SHM_SUPPORTED
+typedef chrono::steady_clock::time_point TimePoint;
+
+class KeptFd {
+ public:
+  int fd;
+  TimePoint expire;
+  // receivers of key not acked yet, closed when empty after posted
+  string key;
+  set<int64_t> waiting;
+};
+
+// memfds posted by inode. closed when receivers acked, or after
+// SHM_KEEP_MS by reaper thread
+class KeptShm {
+ public:
+  mutex mtx;
+  condition_variable cond;
+  map<int64_t, KeptFd> fds;
+  // in order of expire, inodes of acked fds skipped
+  deque<pair<TimePoint, int64_t>> expires;
+  // receivers acked by key
+  map<string, set<int64_t>> receivers;
+  bool reaping = false;
+
+  void close(map<int64_t, KeptFd>::iterator it) {
+    ::close(it->second.fd);
+    fds.erase(it);
+  }
+
+  // receivers not acked in time closed or stopped accepting memfds
+  void expire(map<int64_t, KeptFd>::iterator it) {
+    auto rit = receivers.find(it->second.key);
+    if (rit != receivers.end()) {
+      for (auto wit = it->second.waiting.begin();
+           wit != it->second.waiting.end(); ++wit)
+        rit->second.erase(*wit);
+      if (rit->second.empty())
+        receivers.erase(rit);
+    }
+    close(it);
+  }
+
+  // true if front of expires handled, false if not expired yet
+  bool expireFront(TimePoint now) {
+    pair<TimePoint, int64_t> front = expires.front();
+    auto it = fds.find(front.second);
+    // acked already, inode may be reused by a later memfd
+    if (it == fds.end() || it->second.expire != front.first) {
+      expires.pop_front();
+      return true;
+    }
+    if (now < front.first)
+      return false;
+    expires.pop_front();
+    expire(it);
+    return true;
+  }
+};
+
+// never destroyed, reaper thread may still wait on it at exit
+static KeptShm* kept = new KeptShm();
+
+static void* reapKeptFds(void*) {
+  unique_lock<mutex> locker(kept->mtx);
+  while (true) {
+    if (kept->expires.empty()) {
+      kept->cond.wait(locker);
+      continue;
+    }
+    if (!kept->expireFront(chrono::steady_clock::now()))
+      kept->cond.wait_until(locker, kept->expires.front().first);
+  }
+}
+
+static void keepFd(int fd, int64_t ino) {
+  TimePoint now = chrono::steady_clock::now();
+  lock_guard<mutex> locker(kept->mtx);
+  while (!kept->expires.empty() && kept->expireFront(now))
+    ;
+  TimePoint expire = now + chrono::milliseconds(SHM_KEEP_MS);
+  KeptFd& kfd = kept->fds[ino];
+  kfd.fd = fd;
+  kfd.expire = expire;
+  kept->expires.push_back(make_pair(expire, ino));
+  if (kept->reaping) {
+    if (kept->expires.size() == 1)
+      kept->cond.notify_one();
+    return;
+  }
+  // without thread, expired fds closed on next keepFd
+  pthread_t reaper;
+  if (pthread_create(&reaper, nullptr, reapKeptFds, nullptr) == 0) {
+    pthread_detach(reaper);
+    kept->reaping = true;
+  }
+}
+#endif
+
+bool writeShmBinary(shared_ptr<Caps>& caps, const void* data,
+                    uint32_t length) {
+#ifdef SHM_SUPPORTED
+  // not leaked to child processes while kept
+  int fd =
+      syscall(__NR_memfd_create, "flora-shm", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+  if (fd < 0)
+    return false;
+  const char* p = reinterpret_cast<const char*>(data);
+  uint32_t written = 0;
+  while (written < length) {
+    ssize_t r = ::write(fd, p + written, length - written);
+    if (r <= 0) {
+      ::close(fd);
+      return false;
+    }
+    written += r;
+  }
+  // receivers map data as it is now
+  struct stat st;
+  if (fcntl(fd, F_ADD_SEALS, SHM_SEALS | F_SEAL_SEAL) != 0 ||
+      fstat(fd, &st) != 0) {
+    ::close(fd);
+    return false;
+  }
+  shared_ptr<Caps> desc = Caps::new_instance();
+  desc->write(SHM_MAGIC);
+  desc->write(static_cast<int32_t>(getpid()));
+  desc->write(static_cast<int32_t>(fd));
+  desc->write(length);
+  desc->write(static_cast<int64_t>(st.st_ino));
+  caps->write(desc);
+  keepFd(fd, st.st_ino);
+  return true;
+#else
+  return false;
+#endif
+}
+
+bool shmAccepted(const string& key) {
+#ifdef SHM_SUPPORTED
+  lock_guard<mutex> locker(kept->mtx);
+  return kept->receivers.find(key) != kept->receivers.end();
+#else
+  return false;
+#endif
+}
+
+void shmPosted(shared_ptr<Caps>& msg, const string& key) {
+#ifdef SHM_SUPPORTED
+  if (msg.get() == nullptr)
+    return;
+  int32_t self = getpid();
+  lock_guard<mutex> locker(kept->mtx);
+  auto rit = kept->receivers.find(key);
+  bool large = false;
+  walkShmBinaries(msg, [&](shared_ptr<Caps>& obj) {
+    int32_t pid;
+    int32_t fd;
+    uint32_t length;
+    int64_t ino;
+    if (!readShmDesc(obj, pid, fd, length, ino) || pid != self)
+      return true;
+    auto it = kept->fds.find(ino);
+    if (it == kept->fds.end())
+      return true;
+    it->second.key = key;
+    // no receiver known, kept until expired
+    if (rit != kept->receivers.end())
+      it->second.waiting = rit->second;
+    else
+      it->second.waiting.clear();
+    return true;
+  }, large);
+#endif
+}
+
+void ackShmBinary(const string& key, int64_t receiver, int64_t inode) {
+#ifdef SHM_SUPPORTED
+  lock_guard<mutex> locker(kept->mtx);
+  kept->receivers[key].insert(receiver);
+  if (inode == 0)
+    return;
+  auto it = kept->fds.find(inode);
+  if (it == kept->fds.end() || it->second.key != key)
+    return;
+  if (it->second.waiting.erase(receiver) && it->second.waiting.empty())
+    kept->close(it);
+#endif
+}
+
+bool isShmBinary(shared_ptr<Caps>& obj) {
+  if (obj.get() == nullptr || obj->next_type() != CAPS_MEMBER_TYPE_STRING)
+    return false;
+  const char* magic = nullptr;
+  bool r = obj->read(magic) == CAPS_SUCCESS && magic != nullptr &&
+           strcmp(magic, SHM_MAGIC) == 0;
+  obj->rewind();
+  return r;
+}
+
+int64_t shmBinaryInode(shared_ptr<Caps>& obj) {
+  int32_t pid;
+  int32_t fd;
+  uint32_t length;
+  int64_t ino;
+  if (!readShmDesc(obj, pid, fd, length, ino))
+    return 0;
+  return ino;
+}
+
+#ifdef SHM_SUPPORTED
+static void* mapShmBinary(shared_ptr<Caps>& obj, uint32_t pid,
+                          uint32_t& length, int64_t& ino) {
+  int32_t descPid;
+  int32_t fd;
+  if (!readShmDesc(obj, descPid, fd, length, ino) || length == 0 ||
+      static_cast<uint32_t>(descPid) != pid)
+    return nullptr;
+  string path = "/proc/" + to_string(pid) + "/fd/" + to_string(fd);
+  // no blocking on fifos, no controlling tty, whatever the fd is
+  int mfd = ::open(path.c_str(), O_RDONLY | O_NONBLOCK | O_NOCTTY | O_CLOEXEC);
+  if (mfd < 0)
+    return nullptr;
+  // fd closed and number reused by sender, or not a sealed memfd
+  struct stat st;
+  struct statfs sfs;
+  int seals;
+  if (fstat(mfd, &st) != 0 || !S_ISREG(st.st_mode) ||
+      static_cast<int64_t>(st.st_ino) != ino || st.st_size != length ||
+      fstatfs(mfd, &sfs) != 0 || sfs.f_type != TMPFS_MAGIC ||
+      (seals = fcntl(mfd, F_GET_SEALS)) < 0 ||
+      (seals & SHM_SEALS) != SHM_SEALS) {
+    ::close(mfd);
+    return nullptr;
+  }
+  // MAP_PRIVATE, writes of receiver not seen by others
+  void* data =
+      mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE, mfd, 0);
+  ::close(mfd);
+  if (data == MAP_FAILED)
+    return nullptr;
+  return data;
+}
+#endif
+
+void listShmBinaries(shared_ptr<Caps>& msg, vector<int64_t>& inodes,
+                     bool& large) {
+  if (msg.get() == nullptr)
+    return;
+  walkShmBinaries(msg, [&](shared_ptr<Caps>& obj) {
+    int64_t ino = shmBinaryInode(obj);
+    if (ino != 0)
+      inodes.push_back(ino);
+    return true;
+  }, large);
+}
+
+bool mapShmBinaries(shared_ptr<Caps>& msg, uint32_t pid,
+                    ShmBinaries& binaries, bool& large) {
+  if (msg.get() == nullptr)
+    return true;
+  return walkShmBinaries(msg, [&](shared_ptr<Caps>& obj) {
+#ifdef SHM_SUPPORTED
+    uint32_t length;
+    int64_t ino;
+    void* data = mapShmBinary(obj, pid, length, ino);
+    if (data == nullptr)
+      return false;
+    binaries[ino] = make_shared<ShmBinary>(data, length);
+    return true;
+#else
+    return false;
+#endif
+  }, large);
+}
+
+ShmBinary::~ShmBinary() {
+  munmap(data, length);
+}
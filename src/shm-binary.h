@@ -0,0 +1,73 @@
+#pragma once
+
+#include <stdint.h>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+#include "caps.h"
+
+// large binary members posted between agents on same host passed by
+// memfd, as object member [ SHM_MAGIC, pid, fd, length, inode ].
+// receiver maps the fd through /proc/<pid>/fd/<fd>, so sender keeps fd
+// opened until receivers acked it, at most SHM_KEEP_MS after posted.
+// memfd sealed against writes, receiver maps fds of sealed memfds of the
+// msg sender only.
+//
+// receivers accepting memfds post [ name, receiver, inode... ] to
+// SHM_ACK_PREFIX + pid of sender after mapping memfds of a msg, or after
+// a msg with copied binaries not smaller than SHM_MIN_SIZE. sender posts
+// memfds for a msg name only after some receiver of it acked
+#define SHM_MAGIC "\001flora-shm"
+#define SHM_ACK_PREFIX "\001flora-shm-ack/"
+// binary members smaller than it are copied as before
+#define SHM_MIN_SIZE 65536
+#define SHM_KEEP_MS 10000
+
+// memfd mapped by receiver, unmapped when last Buffer on it released
+class ShmBinary {
+ public:
+  ShmBinary(void* d, uint32_t l) : data(d), length(l) {
+  }
+  ~ShmBinary();
+
+  void* data;
+  uint32_t length;
+};
+
+// memfds of a received msg mapped, by inode
+typedef std::map<int64_t, std::shared_ptr<ShmBinary>> ShmBinaries;
+
+// copy data to a new memfd and write descriptor member to caps.
+// returns false if memfd not supported
+bool writeShmBinary(std::shared_ptr<Caps>& caps, const void* data,
+                    uint32_t length);
+
+// key is dispatcher uri and msg name, joined by '\0'.
+// true if any receiver of key acked and not lost since
+bool shmAccepted(const std::string& key);
+
+// memfds of msg written by this process kept until receivers of key
+// acked them, or SHM_KEEP_MS expired. invoked before msg posted
+void shmPosted(std::shared_ptr<Caps>& msg, const std::string& key);
+
+// receiver of key accepts memfds, and has mapped memfd of inode if not 0
+void ackShmBinary(const std::string& key, int64_t receiver, int64_t inode);
+
+// obj member read from caps, rewound before return
+bool isShmBinary(std::shared_ptr<Caps>& obj);
+
+// inode of descriptor, 0 if obj not a descriptor
+int64_t shmBinaryInode(std::shared_ptr<Caps>& obj);
+
+// inodes of all descriptors in msg, not mapped. large set as
+// mapShmBinaries
+void listShmBinaries(std::shared_ptr<Caps>& msg, std::vector<int64_t>& inodes,
+                     bool& large);
+
+// map memfds of all descriptors in msg posted by process pid, private
+// copy-on-write mappings. returns false if any memfd closed by sender
+// already, or fd is not a sealed memfd of pid. large set if msg has
+// copied binary members not smaller than SHM_MIN_SIZE
+bool mapShmBinaries(std::shared_ptr<Caps>& msg, uint32_t pid,
+                    ShmBinaries& binaries, bool& large);
@@ -4,6 +4,8 @@ var test = require('tape')
 var flora = require('..')
 var Agent = flora.Agent
 var agentOptions = { reconnInterval: 10000, bufsize: 0 }
+// first msgs of a name copied until receiver acked, buffer holds them
+var shmOptions = { reconnInterval: 10000, bufsize: 512 * 1024, sharedMemory: true }
 var okUri = 'unix:/var/run/flora.sock'
 var crypto = require('crypto')
 
@@ -26,3 +28,151 @@ test('flora write message types', t => {
   postClient.post(msgName, writeMsg)
   postClient.close()
 })
+
+test('flora write binary message members', t => {
+  var recvClient = new Agent(okUri, agentOptions)
+
+  var msgId = crypto.randomBytes(5).toString('hex')
+  var msgName = `binary msg test[${msgId}]`
+
+  var bytes = crypto.randomBytes(64)
+  var floats = new Float32Array([ 1.5, -2.25 ])
+  var writeMsg = [ bytes, floats.buffer, floats, 'tail' ]
+  recvClient.subscribe(msgName, (msg, type) => {
+    t.ok(Buffer.isBuffer(msg[0]))
+    t.equal(msg[0].toString('hex'), bytes.toString('hex'))
+    t.equal(msg[1].length, 8)
+    t.equal(msg[2].toString('hex'), Buffer.from(floats.buffer).toString('hex'))
+    t.equal(msg[3], 'tail')
+    t.end()
+    recvClient.close()
+  })
+  recvClient.start()
+  var postClient = new Agent(okUri, agentOptions)
+  postClient.start()
+  postClient.post(msgName, writeMsg)
+  postClient.close()
+})
+
+test('flora lazy message format', t => {
+  var recvClient = new Agent(okUri, agentOptions)
+
+  var msgId = crypto.randomBytes(5).toString('hex')
+  var msgName = `lazy msg test[${msgId}]`
+
+  var writeMsg = [32, 'hello flora', ['123', [4]], null]
+  var expectedMsg = [32, 'hello flora', ['123', [4]], undefined]
+  recvClient.subscribe(msgName, (msg, type) => {
+    t.equal(msg.length, 4)
+    t.equal(msg[1], 'hello flora')
+    t.equal(msg[2][1][0], 4)
+    t.equal(msg[4], undefined)
+    t.deepEqual(msg, expectedMsg)
+    t.end()
+    recvClient.close()
+  }, { format: 'lazy' })
+  recvClient.start()
+  var postClient = new Agent(okUri, agentOptions)
+  postClient.start()
+  postClient.post(msgName, writeMsg)
+  postClient.close()
+})
+
+test('flora binary message members by shared memory', t => {
+  var recvClient = new Agent(okUri, shmOptions)
+
+  var msgId = crypto.randomBytes(5).toString('hex')
+  var msgName = `shared memory msg test[${msgId}]`
+
+  var large = crypto.randomBytes(256 * 1024)
+  var small = crypto.randomBytes(64)
+  recvClient.subscribe(msgName, (msg, type) => {
+    t.ok(Buffer.isBuffer(msg[0]))
+    t.ok(large.equals(msg[0]))
+    t.ok(small.equals(msg[1]))
+    t.end()
+    recvClient.close()
+  })
+  recvClient.start()
+  var postClient = new Agent(okUri, shmOptions)
+  postClient.start()
+  postClient.post(msgName, [ large, small ])
+  postClient.close()
+})
+
+test('flora binary message members by shared memory after receiver acked', t => {
+  var recvClient = new Agent(okUri, shmOptions)
+  var postClient = new Agent(okUri, shmOptions)
+
+  var msgId = crypto.randomBytes(5).toString('hex')
+  var msgName = `shared memory acked msg test[${msgId}]`
+
+  var frames = [ crypto.randomBytes(128 * 1024), crypto.randomBytes(128 * 1024), crypto.randomBytes(128 * 1024) ]
+  var received = []
+  recvClient.subscribe(msgName, (msg, type) => {
+    received.push(msg[0])
+  })
+  recvClient.start()
+  postClient.start()
+  frames.forEach((frame, i) => {
+    setTimeout(() => postClient.post(msgName, [ frame ]), 500 + i * 200)
+  })
+  setTimeout(() => {
+    t.equal(received.length, frames.length)
+    frames.forEach((frame, i) => {
+      t.ok(frame.equals(received[i]))
+    })
+    recvClient.close()
+    postClient.close()
+    t.end()
+  }, 1500)
+})
+
+test('flora binary message members copied to receiver not accepting shared memory', t => {
+  var recvClient = new Agent(okUri, { reconnInterval: 10000, bufsize: 512 * 1024 })
+  var postClient = new Agent(okUri, shmOptions)
+
+  var msgId = crypto.randomBytes(5).toString('hex')
+  var msgName = `shared memory not accepted msg test[${msgId}]`
+
+  var frames = [ crypto.randomBytes(128 * 1024), crypto.randomBytes(128 * 1024) ]
+  var received = []
+  recvClient.subscribe(msgName, (msg, type) => {
+    received.push(msg[0])
+  })
+  recvClient.start()
+  postClient.start()
+  frames.forEach((frame, i) => {
+    setTimeout(() => postClient.post(msgName, [ frame ]), 500 + i * 200)
+  })
+  setTimeout(() => {
+    t.equal(received.length, frames.length)
+    frames.forEach((frame, i) => {
+      t.ok(Buffer.isBuffer(received[i]))
+      t.ok(frame.equals(received[i]))
+    })
+    recvClient.close()
+    postClient.close()
+    t.end()
+  }, 1500)
+})
+
+test('flora message types decoded on flora thread', t => {
+  var recvClient = new Agent(okUri, { reconnInterval: 10000, bufsize: 0, predecode: true })
+
+  var msgId = crypto.randomBytes(5).toString('hex')
+  var msgName = `predecode msg test[${msgId}]`
+
+  var writeMsg = [32, 64.5, 'hello flora', '', null, ['123', [4, 'nested']], []]
+  var expectedMsg = [32, 64.5, 'hello flora', '', undefined, ['123', [4, 'nested']], []]
+  recvClient.subscribe(msgName, (msg, type) => {
+    t.deepEqual(msg, expectedMsg)
+    t.end()
+    recvClient.close()
+  })
+  recvClient.start()
+  var postClient = new Agent(okUri, agentOptions)
+  postClient.start()
+  postClient.post(msgName, writeMsg)
+  postClient.close()
+})
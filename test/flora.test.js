@@ -378,6 +378,55 @@ test('module->flora->client: instant msg, unsubscribe msg', t => {
   }, 2000)
 })
 
+test('module->flora->client: unsubscribe msg, topic id reused by other name', t => {
+  var msgId = crypto.randomBytes(5).toString('hex')
+  var nameA = `topic reuse test a[${msgId}]`
+  var nameB = `topic reuse test b[${msgId}]`
+  var countA = 0
+  var recvB = []
+  var recvA = []
+
+  var recvClient = new Agent(okUri, agentOptions)
+  recvClient.subscribe(nameA, (msg, type) => {
+    if (++countA > 1) {
+      return
+    }
+    // id of nameA released and taken by nameB, while later msgs of nameA
+    // may still be pending
+    recvClient.unsubscribe(nameA)
+    recvClient.subscribe(nameB, (msg, type) => {
+      recvB.push(msg[0])
+    })
+  })
+  recvClient.start()
+  var postClient = new Agent(okUri, agentOptions)
+  postClient.start()
+
+  setTimeout(() => {
+    for (var i = 0; i < 5; ++i) {
+      postClient.post(nameA, [ 'a' + i ])
+    }
+  }, 500)
+  setTimeout(() => {
+    recvClient.subscribe(nameA, (msg, type) => {
+      recvA.push(msg[0])
+    })
+  }, 800)
+  setTimeout(() => {
+    postClient.post(nameB, [ 'b' ])
+    postClient.post(nameA, [ 'a' ])
+  }, 1100)
+
+  setTimeout(() => {
+    t.equal(countA, 1)
+    t.deepEqual(recvB, [ 'b' ])
+    t.deepEqual(recvA, [ 'a' ])
+    recvClient.close()
+    postClient.close()
+    t.end()
+  }, 1600)
+})
+
 test('module->flora->client: persist msg, subscribe->send->unsubscribe->send', t => {
   var int32 = 32
   var int64 = 64
@@ -696,3 +745,824 @@ test('module->flora->client: rpc call target', { timeout: 10 * 1000 }, t => {
     t.end()
   }, 3500)
 })
+
+test('module->flora->client: pending msgs limit, drop newest', { timeout: 10 * 1000 }, t => {
+  var msgId = crypto.randomBytes(5).toString('hex')
+  var msgName = `pending limit test[${msgId}]`
+  var recvCount = 0
+  var recvClient = new Agent(okUri, { reconnInterval: 10000, bufsize: 0, maxPendingMsgs: 2, overflowPolicy: 'drop-newest' })
+  recvClient.subscribe(msgName, (msg, type) => {
+    ++recvCount
+    t.equal(msg[0], recvCount - 1)
+  })
+  recvClient.start()
+  var postClient = new Agent(okUri, agentOptions)
+  postClient.start()
+
+  setTimeout(() => {
+    var i
+    for (i = 0; i < 10; ++i) {
+      postClient.post(msgName, [ i ])
+    }
+    // block js thread, msgs queued by flora thread meanwhile
+    var end = Date.now() + 1000
+    while (Date.now() < end) {}
+  }, 500)
+
+  setTimeout(() => {
+    var stats = recvClient.getQueueStats()
+    t.equal(recvCount, 2)
+    t.equal(stats.dropped, 8)
+    t.equal(stats.highWaterMark, 2)
+    t.equal(stats.pending, 0)
+    recvClient.close()
+    postClient.close()
+    t.end()
+  }, 3000)
+})
+
+test('module->flora->client: dispatch budget yields to event loop', { timeout: 10 * 1000 }, t => {
+  var msgId = crypto.randomBytes(5).toString('hex')
+  var msgName = `dispatch budget test[${msgId}]`
+  var recvCount = 0
+  var immediateRanAt = -1
+  var recvClient = new Agent(okUri, { reconnInterval: 10000, bufsize: 0, dispatchBudgetMsgs: 1 })
+  recvClient.subscribe(msgName, (msg, type) => {
+    ++recvCount
+    if (recvCount === 1) {
+      setImmediate(() => {
+        immediateRanAt = recvCount
+      })
+    }
+  })
+  recvClient.start()
+  var postClient = new Agent(okUri, agentOptions)
+  postClient.start()
+
+  setTimeout(() => {
+    var i
+    for (i = 0; i < 5; ++i) {
+      postClient.post(msgName, [ i ])
+    }
+    var end = Date.now() + 1000
+    while (Date.now() < end) {}
+  }, 500)
+
+  setTimeout(() => {
+    t.equal(recvCount, 5)
+    t.equal(immediateRanAt, 1)
+    recvClient.close()
+    postClient.close()
+    t.end()
+  }, 3000)
+})
+
+test('module->flora->client: subscribe with msg filter', { timeout: 10 * 1000 }, t => {
+  var msgId = crypto.randomBytes(5).toString('hex')
+  var msgName = `msg filter test[${msgId}]`
+  var recvMsgs = []
+  var recvClient = new Agent(okUri, agentOptions)
+  recvClient.subscribe(msgName, (msg, type) => {
+    recvMsgs.push(msg)
+  }, { filter: [ { index: 0, equals: [ 'dev1', 'dev2' ] }, { index: [ 1, 0 ], type: 'number' } ] })
+  recvClient.start()
+  var postClient = new Agent(okUri, agentOptions)
+  postClient.start()
+
+  t.throws(() => {
+    recvClient.subscribe(msgName + 'x', () => {}, { filter: { equals: 1 } })
+  }, /invalid msg filter/)
+
+  setTimeout(() => {
+    postClient.post(msgName, [ 'dev1', [ 1 ] ])
+    postClient.post(msgName, [ 'dev3', [ 2 ] ])
+    postClient.post(msgName, [ 'dev2', [ 'foo' ] ])
+    postClient.post(msgName, [ 'dev2', [ 4.5 ] ])
+    postClient.post(msgName, [ 'dev2' ])
+    postClient.post(msgName)
+  }, 500)
+
+  setTimeout(() => {
+    t.deepEqual(recvMsgs, [ [ 'dev1', [ 1 ] ], [ 'dev2', [ 4.5 ] ] ])
+    recvClient.close()
+    postClient.close()
+    t.end()
+  }, 2000)
+})
+
+test('module->flora->client: multiple handlers of one msg name', { timeout: 10 * 1000 }, t => {
+  var msgId = crypto.randomBytes(5).toString('hex')
+  var msgName = `fan out test[${msgId}]`
+  var counts = [ 0, 0, 0 ]
+  var recvClient = new Agent(okUri, agentOptions)
+  var sub0 = recvClient.subscribe(msgName, (msg, type) => {
+    // not seen by other handlers
+    msg[0] = 'modified'
+    ++counts[0]
+  })
+  recvClient.subscribe(msgName, (msg, type) => {
+    t.equal(msg[0], 'hello')
+    ++counts[1]
+  })
+  recvClient.subscribe(msgName, (msg, type) => {
+    ++counts[2]
+  }, { filter: { index: 1, equals: 1 } })
+  recvClient.start()
+  var postClient = new Agent(okUri, agentOptions)
+  postClient.start()
+
+  setTimeout(() => {
+    postClient.post(msgName, [ 'hello', 1 ])
+    postClient.post(msgName, [ 'hello', 2 ])
+  }, 500)
+  setTimeout(() => {
+    sub0.unsubscribe()
+    postClient.post(msgName, [ 'hello', 1 ])
+  }, 1000)
+
+  setTimeout(() => {
+    t.deepEqual(counts, [ 2, 3, 2 ])
+    recvClient.close()
+    postClient.close()
+    t.end()
+  }, 2000)
+})
+
+test('module->flora->client: agents share connection', { timeout: 10 * 1000 }, t => {
+  var msgId = crypto.randomBytes(5).toString('hex')
+  var msgName = `share connection test[${msgId}]`
+  var options = Object.assign({ shareConnection: true }, agentOptions)
+  var client1 = new Agent(okUri, options)
+  // other ids share the connection too
+  var client2 = new Agent(`${okUri}#share-${msgId}`, options)
+  t.throws(() => {
+    client2.declareMethod(msgName, (msg, reply) => {})
+  }, /could not declare method/)
+  t.throws(() => {
+    return new Agent(okUri, Object.assign({}, options, { bufsize: 4096 }))
+  }, /bufsize/)
+  var counts = [ 0, 0 ]
+  client1.subscribe(msgName, (msg, type) => {
+    ++counts[0]
+  })
+  client2.subscribe(msgName, (msg, type) => {
+    ++counts[1]
+  })
+  client1.start()
+  client2.start()
+  var postClient = new Agent(okUri, agentOptions)
+  postClient.start()
+
+  setTimeout(() => {
+    t.equal(client1.getSocket(), client2.getSocket())
+    postClient.post(msgName, [ 'hello' ])
+  }, 500)
+  setTimeout(() => {
+    client1.close()
+    postClient.post(msgName, [ 'hello' ])
+  }, 1000)
+
+  setTimeout(() => {
+    t.deepEqual(counts, [ 1, 2 ])
+    client2.close()
+    postClient.close()
+    t.end()
+  }, 2000)
+})
+
+test('module->flora->client: agents share connection persist msg', { timeout: 10 * 1000 }, t => {
+  var msgId = crypto.randomBytes(5).toString('hex')
+  var msgName = `share connection persist test[${msgId}]`
+  var options = Object.assign({ shareConnection: true }, agentOptions)
+  var postClient = new Agent(okUri, agentOptions)
+  postClient.start()
+  setTimeout(() => {
+    postClient.post(msgName, [ 'volume', 30 ], flora.MSGTYPE_PERSIST)
+  }, 300)
+
+  var received = [ [], [], [] ]
+  var client1 = new Agent(okUri, options)
+  var client2 = new Agent(`${okUri}#share-persist-${msgId}`, options)
+  setTimeout(() => {
+    client1.subscribe(msgName, (msg, type) => {
+      received[0].push([ msg, type ])
+    })
+    client1.start()
+  }, 600)
+  // name subscribed on the connection already, no replay by flora
+  setTimeout(() => {
+    client1.subscribe(msgName, (msg, type) => {
+      received[1].push([ msg, type ])
+    })
+    client2.subscribe(msgName, (msg, type) => {
+      received[2].push([ msg, type ])
+    }, { filter: { index: 0, equals: 'volume' } })
+    client2.start()
+  }, 1100)
+
+  setTimeout(() => {
+    var expected = [ [ [ 'volume', 30 ], flora.MSGTYPE_PERSIST ] ]
+    t.deepEqual(received, [ expected, expected, expected ])
+    client1.close()
+    client2.close()
+    postClient.close()
+    t.end()
+  }, 1800)
+})
+
+test('module->flora->client: post prepared msg', { timeout: 10 * 1000 }, t => {
+  var msgId = crypto.randomBytes(5).toString('hex')
+  var msgName = `prepared msg test[${msgId}]`
+  var received = []
+  var recvClient = new Agent(okUri, agentOptions)
+  recvClient.subscribe(msgName, (msg, type) => {
+    received.push(msg)
+  })
+  recvClient.start()
+  var postClient = new Agent(okUri, agentOptions)
+  postClient.start()
+  var prepared = postClient.prepare(msgName, [ 'status', 0, [ 'foo' ] ])
+
+  setTimeout(() => {
+    prepared.post()
+    prepared.set(1, 100)
+    prepared.post()
+    prepared.set(3, 'bar')
+    prepared.post()
+    t.throws(() => prepared.set(5, 1))
+  }, 500)
+
+  setTimeout(() => {
+    t.deepEqual(received, [
+      [ 'status', 0, [ 'foo' ] ],
+      [ 'status', 100, [ 'foo' ] ],
+      [ 'status', 100, [ 'foo' ], 'bar' ]
+    ])
+    recvClient.close()
+    postClient.close()
+    t.end()
+  }, 1500)
+})
+
+test('module->flora->client: post batch', { timeout: 10 * 1000 }, t => {
+  var msgId = crypto.randomBytes(5).toString('hex')
+  var msgName = `post batch test[${msgId}]`
+  var received = []
+  var recvClient = new Agent(okUri, agentOptions)
+  recvClient.subscribe(msgName, (msg, type) => {
+    received.push(msg[0])
+  })
+  recvClient.start()
+  var postClient = new Agent(okUri, agentOptions)
+  postClient.start()
+
+  setTimeout(() => {
+    var r = postClient.postBatch([
+      [ msgName, [ 0 ] ],
+      [ msgName, [ 1 ], flora.MSGTYPE_INSTANT ],
+      [ 1, [ 2 ] ],
+      [ msgName, [ 3 ], 100 ],
+      [ msgName, [ 4 ] ]
+    ])
+    t.deepEqual(r, [ 0, 0, flora.ERROR_INVALID_PARAM, flora.ERROR_INVALID_PARAM, 0 ])
+  }, 500)
+
+  setTimeout(() => {
+    t.deepEqual(received, [ 0, 1, 4 ])
+    recvClient.close()
+    postClient.close()
+    t.end()
+  }, 1500)
+})
+
+test('module->flora->client: rpc call many targets', { timeout: 10 * 1000 }, t => {
+  var methodName = 'call many ' + crypto.randomBytes(5).toString('hex')
+  var targets = [ 'callManyAgent1', 'callManyAgent2' ]
+  var agents = targets.map((id, idx) => {
+    var agent = new Agent(okUri + '#' + id, agentOptions)
+    agent.declareMethod(methodName, (msg, reply) => {
+      reply.end(0, [ msg[0] + idx ])
+    })
+    agent.start()
+    return agent
+  })
+  var caller = new Agent(okUri, agentOptions)
+  caller.start()
+
+  setTimeout(() => {
+    caller.callMany(methodName, [ 10 ], targets.concat('missingTarget')).then((results) => {
+      t.equal(results.length, 3)
+      t.equal(results[0].target, targets[0])
+      t.equal(results[0].code, 0)
+      t.deepEqual(results[0].response.msg, [ 10 ])
+      t.equal(results[1].code, 0)
+      t.deepEqual(results[1].response.msg, [ 11 ])
+      t.equal(results[2].code, flora.ERROR_TARGET_NOT_EXISTS)
+      t.equal(results[2].error.code, flora.ERROR_TARGET_NOT_EXISTS)
+      agents.forEach((agent) => agent.close())
+      caller.close()
+      t.end()
+    }, (err) => {
+      t.fail('call many failed: ' + err)
+    })
+  }, 500)
+})
+
+test('module->flora->client: pending calls rejected when closed', { timeout: 10 * 1000 }, t => {
+  var methodName = 'pending call ' + crypto.randomBytes(5).toString('hex')
+  var callee = new Agent(okUri + '#pendingCallAgent', agentOptions)
+  callee.declareMethod(methodName, (msg, reply) => {
+    // never reply
+  })
+  callee.start()
+  var caller = new Agent(okUri, agentOptions)
+  caller.start()
+
+  setTimeout(() => {
+    caller.call(methodName, null, 'pendingCallAgent', 60000).then(() => {
+      t.fail('call should not be resolved')
+    }, (err) => {
+      t.equal(err.code, flora.ERROR_NOT_CONNECTED)
+      t.equal(caller.pendingCalls(), undefined)
+      callee.close()
+      t.end()
+    })
+  }, 500)
+  setTimeout(() => {
+    var stats = caller.pendingCalls()
+    t.equal(stats.count, 1)
+    t.equal(stats.overdue, 0)
+    t.equal(stats.calls[0].name, methodName)
+    t.equal(stats.calls[0].target, 'pendingCallAgent')
+    t.ok(stats.oldestAge >= 0)
+    caller.close()
+  }, 1000)
+})
+
+test('module->flora->client: call of agent not started rejected', { timeout: 10 * 1000 }, t => {
+  var caller = new Agent(okUri, agentOptions)
+  caller.call('not started call', null, 'notStartedAgent', 1000).then(() => {
+    t.fail('call should not be resolved')
+  }, (err) => {
+    t.equal(err.code, flora.ERROR_NOT_CONNECTED)
+    // closed without started
+    caller.close()
+    t.equal(caller.pendingCalls(), undefined)
+    t.end()
+  })
+})
+
+test('module->flora->client: cancel call by signal', { timeout: 10 * 1000 }, t => {
+  var methodName = 'cancel call ' + crypto.randomBytes(5).toString('hex')
+  var callee = new Agent(okUri + '#cancelCallAgent', agentOptions)
+  callee.declareMethod(methodName, (msg, reply) => {
+    setTimeout(() => reply.end(0), 500)
+  })
+  callee.start()
+  var caller = new Agent(okUri, agentOptions)
+  caller.start()
+  // AbortSignal like
+  var listeners = []
+  var signal = {
+    aborted: false,
+    addEventListener: (type, fn) => listeners.push(fn),
+    removeEventListener: (type, fn) => {
+      listeners = listeners.filter((l) => l !== fn)
+    }
+  }
+
+  setTimeout(() => {
+    caller.call(methodName, null, 'cancelCallAgent', 5000, { signal: signal }).then(() => {
+      t.fail('canceled call should not be resolved')
+    }, (err) => {
+      t.equal(err.code, flora.ERROR_CANCELED)
+      t.equal(caller.pendingCalls().count, 0)
+      t.equal(listeners.length, 0)
+    })
+    signal.aborted = true
+    listeners.slice().forEach((fn) => fn())
+  }, 500)
+  setTimeout(() => {
+    caller.close()
+    callee.close()
+    t.end()
+  }, 1500)
+})
+
+test('module->flora->client: stream reply chunks', { timeout: 10 * 1000 }, t => {
+  var methodName = 'call stream ' + crypto.randomBytes(5).toString('hex')
+  var callee = new Agent(okUri + '#callStreamAgent', agentOptions)
+  callee.declareMethod(methodName, (msg, reply) => {
+    t.deepEqual(msg, [ 'page', 2 ])
+    reply.writeData([ 'a' ])
+    setTimeout(() => {
+      reply.writeData([ 'b' ])
+      reply.end(0, [ 'c' ])
+    }, 100)
+  }, { stream: true })
+  callee.start()
+  var caller = new Agent(okUri, agentOptions)
+  caller.start()
+
+  setTimeout(() => {
+    var stream = caller.callStream(methodName, [ 'page', 2 ], 'callStreamAgent')
+    var chunks = []
+    var consume = () => {
+      stream.next().then((res) => {
+        if (res.done) {
+          t.deepEqual(chunks, [ [ 'a' ], [ 'b' ], [ 'c' ] ])
+          t.equal(stream.retCode, 0)
+          caller.close()
+          callee.close()
+          t.end()
+          return
+        }
+        chunks.push(res.value)
+        consume()
+      }, (err) => {
+        t.fail('call stream failed: ' + err)
+      })
+    }
+    consume()
+  }, 500)
+})
+
+test('module->flora->client: stream chunks not dropped by full queue', { timeout: 10 * 1000 }, t => {
+  var methodName = 'call stream ' + crypto.randomBytes(5).toString('hex')
+  var callee = new Agent(okUri + '#callStreamFullAgent', agentOptions)
+  callee.declareMethod(methodName, (msg, reply) => {
+    for (var i = 0; i < 20; ++i) {
+      reply.writeData([ i ])
+    }
+    reply.end(0)
+  }, { stream: true })
+  callee.start()
+  var caller = new Agent(okUri, { reconnInterval: 10000, bufsize: 0, maxPendingMsgs: 1, overflowPolicy: 'drop-oldest' })
+  caller.start()
+
+  setTimeout(() => {
+    var stream = caller.callStream(methodName, [], 'callStreamFullAgent')
+    var chunks = []
+    var consume = () => {
+      stream.next().then((res) => {
+        if (res.done) {
+          t.equal(chunks.length, 20)
+          t.equal(chunks[19][0], 19)
+          t.equal(caller.getQueueStats().dropped, 0)
+          caller.close()
+          callee.close()
+          t.end()
+          return
+        }
+        chunks.push(res.value)
+        consume()
+      }, (err) => {
+        t.fail('call stream failed: ' + err)
+      })
+    }
+    consume()
+    // keep js thread busy, chunks queued meanwhile
+    var end = Date.now() + 300
+    while (Date.now() < end) {}
+  }, 500)
+})
+
+test('module->flora->client: stream fails if chunk lost', { timeout: 10 * 1000 }, t => {
+  var methodName = 'call stream ' + crypto.randomBytes(5).toString('hex')
+  var callee = new Agent(okUri + '#callStreamLostAgent', agentOptions)
+  callee.declareMethod(methodName, (msg, reply) => {
+    reply.writeData([ 'a' ])
+    // chunk 1 lost on the way
+    ++reply.seq
+    reply.writeData([ 'c' ])
+    reply.end(0)
+  }, { stream: true })
+  callee.start()
+  var caller = new Agent(okUri, agentOptions)
+  caller.start()
+
+  setTimeout(() => {
+    var stream = caller.callStream(methodName, [], 'callStreamLostAgent')
+    stream.next().then((res) => {
+      t.deepEqual(res.value, [ 'a' ])
+      return stream.next()
+    }).then(() => {
+      t.fail('stream with lost chunk should fail')
+    }, (err) => {
+      t.equal(err.code, flora.ERROR_CHUNK_LOST)
+    }).then(() => {
+      caller.close()
+      callee.close()
+      t.end()
+    })
+  }, 500)
+})
+
+test('module->flora->client: call stream of method not declared as stream', { timeout: 10 * 1000 }, t => {
+  var methodName = 'call stream ' + crypto.randomBytes(5).toString('hex')
+  var callee = new Agent(okUri + '#callStreamPlainAgent', agentOptions)
+  callee.declareMethod(methodName, (msg, reply) => {
+    t.fail('plain method invoked by callStream')
+    reply.end(0)
+  })
+  callee.start()
+  var caller = new Agent(okUri, agentOptions)
+  caller.start()
+
+  setTimeout(() => {
+    var stream = caller.callStream(methodName, [], 'callStreamPlainAgent')
+    stream.next().then(() => {
+      t.fail('call stream of plain method should fail')
+    }, (err) => {
+      t.ok(err instanceof Error)
+    }).then(() => {
+      caller.close()
+      callee.close()
+      t.end()
+    })
+  }, 500)
+})
+
+test('module->flora->client: post msg larger than bufsize', { timeout: 10 * 1000 }, t => {
+  var msgId = crypto.randomBytes(5).toString('hex')
+  var msgName = `large msg test[${msgId}]`
+  var options = { reconnInterval: 10000, bufsize: 4096 }
+  var large = crypto.randomBytes(20000).toString('hex')
+  var received = []
+  var recvClient = new Agent(okUri, options)
+  recvClient.subscribe(msgName, (msg, type) => {
+    received.push(msg)
+  })
+  recvClient.start()
+  var postClient = new Agent(okUri, Object.assign({ fragment: true }, options))
+  postClient.start()
+
+  setTimeout(() => {
+    postClient.post(msgName, [ 'small' ])
+    postClient.post(msgName, [ large, 1 ])
+    postClient.post(msgName, [ 'small' ])
+  }, 500)
+
+  setTimeout(() => {
+    t.equal(received.length, 3)
+    t.deepEqual(received[1], [ large, 1 ])
+    t.deepEqual(received[2], [ 'small' ])
+    recvClient.close()
+    postClient.close()
+    t.end()
+  }, 1500)
+})
+
+test('module->flora->client: large msg not fragmented if not opted in', { timeout: 10 * 1000 }, t => {
+  var msgId = crypto.randomBytes(5).toString('hex')
+  var msgName = `large msg no fragment test[${msgId}]`
+  var options = { reconnInterval: 10000, bufsize: 262144 }
+  var large = crypto.randomBytes(50000).toString('hex')
+  var received = []
+  // receiver may be c++ service or flora-cli, no fragment decoding
+  var recvClient = new Agent(okUri, options)
+  recvClient.subscribe(msgName, (msg, type) => {
+    received.push(msg)
+  })
+  recvClient.start()
+  var postClient = new Agent(okUri, options)
+  postClient.start()
+
+  setTimeout(() => {
+    postClient.post(msgName, [ large ])
+  }, 500)
+
+  setTimeout(() => {
+    t.equal(received.length, 1)
+    t.deepEqual(received[0], [ large ])
+    recvClient.close()
+    postClient.close()
+    t.end()
+  }, 1500)
+})
+
+test('module->flora->client: peek persist msg', { timeout: 10 * 1000 }, t => {
+  var msgId = crypto.randomBytes(5).toString('hex')
+  var msgName = `peek test[${msgId}]`
+  var postClient = new Agent(okUri, agentOptions)
+  postClient.start()
+  var peekClient = new Agent(okUri + '#peekAgent', agentOptions)
+  peekClient.start()
+
+  setTimeout(() => {
+    t.equal(peekClient.peek(msgName), undefined)
+    postClient.post(msgName, [ 'volume', 30 ], flora.MSGTYPE_PERSIST)
+    t.deepEqual(peekClient.peek(msgName), [ 'volume', 30 ])
+    postClient.post(msgName, [ 'volume', 40 ])
+    t.deepEqual(peekClient.peek(msgName), [ 'volume', 30 ])
+    postClient.post(msgName, [ 'volume', 50 ], flora.MSGTYPE_PERSIST)
+    t.deepEqual(peekClient.peek(msgName, { format: 'lazy' })[1], 50)
+    postClient.close()
+    peekClient.close()
+    t.end()
+  }, 500)
+})
+
+test('module->flora->client: subscribe with maxRate and coalesce', { timeout: 10 * 1000 }, t => {
+  var msgId = crypto.randomBytes(5).toString('hex')
+  var msgName = `limit test[${msgId}]`
+  var all = []
+  var latest = []
+  var limited = []
+  var recvClient = new Agent(okUri, agentOptions)
+  recvClient.subscribe(msgName, (msg) => {
+    all.push(msg[0])
+  })
+  recvClient.subscribe(msgName, (msg) => {
+    latest.push(msg[0])
+  }, { coalesce: 'latest' })
+  recvClient.subscribe(msgName, (msg) => {
+    limited.push(msg[0])
+  }, { maxRate: 1 })
+  recvClient.start()
+  var postClient = new Agent(okUri, agentOptions)
+  postClient.start()
+
+  setTimeout(() => {
+    var i
+    for (i = 0; i < 100; ++i) {
+      postClient.post(msgName, [ i ])
+    }
+    // keep js thread busy, msgs queued meanwhile
+    var end = Date.now() + 300
+    while (Date.now() < end) {}
+  }, 500)
+
+  setTimeout(() => {
+    t.equal(all.length, 100)
+    t.ok(latest.length < 100, 'msgs coalesced')
+    t.equal(latest[latest.length - 1], 99)
+    // newest msg of interval delivered when interval ends
+    t.deepEqual(limited, [ 0, 99 ])
+    recvClient.close()
+    postClient.close()
+    t.end()
+  }, 2500)
+})
+
+test('module->flora->client: high priority msgs dispatched first', { timeout: 10 * 1000 }, t => {
+  var msgId = crypto.randomBytes(5).toString('hex')
+  var lowName = `priority low test[${msgId}]`
+  var highName = `priority high test[${msgId}]`
+  var order = []
+  var recvClient = new Agent(okUri, agentOptions)
+  recvClient.subscribe(lowName, (msg) => {
+    order.push(msg[0])
+  }, { priority: 'low' })
+  recvClient.subscribe(highName, (msg) => {
+    order.push('high')
+  }, { priority: 'high' })
+  recvClient.start()
+  var postClient = new Agent(okUri, agentOptions)
+  postClient.start()
+
+  setTimeout(() => {
+    var i
+    for (i = 0; i < 50; ++i) {
+      postClient.post(lowName, [ i ])
+    }
+    postClient.post(highName, [])
+    // keep js thread busy, msgs queued meanwhile
+    var end = Date.now() + 300
+    while (Date.now() < end) {}
+  }, 500)
+
+  setTimeout(() => {
+    t.equal(order.length, 51)
+    t.equal(order[0], 'high')
+    t.equal(order[1], 0)
+    t.equal(order[50], 49)
+    recvClient.close()
+    postClient.close()
+    t.end()
+  }, 1500)
+})
+
+test('module->flora->client: sender objects reused', { timeout: 10 * 1000 }, t => {
+  var msgId = crypto.randomBytes(5).toString('hex')
+  var msgName = `sender test[${msgId}]`
+  var noSenderName = `no sender test[${msgId}]`
+  var senders = []
+  var noSenders = []
+  var recvClient = new Agent(okUri, agentOptions)
+  recvClient.subscribe(msgName, (msg, type, sender) => {
+    senders.push(sender)
+  })
+  recvClient.subscribe(noSenderName, (msg, type, sender) => {
+    noSenders.push(sender)
+  }, { sender: false })
+  recvClient.start()
+  var postClient = new Agent(okUri + '#senderAgent', agentOptions)
+  postClient.start()
+
+  setTimeout(() => {
+    postClient.post(msgName, [ 1 ])
+    postClient.post(msgName, [ 2 ])
+    postClient.post(noSenderName, [ 1 ])
+  }, 500)
+
+  setTimeout(() => {
+    t.equal(senders.length, 2)
+    t.equal(senders[0], senders[1])
+    t.equal(senders[0].pid, process.pid)
+    t.equal(senders[0].name, 'senderAgent')
+    t.ok(Object.isFrozen(senders[0]))
+    t.deepEqual(noSenders, [ undefined ])
+    recvClient.close()
+    postClient.close()
+    t.end()
+  }, 1500)
+})
+
+test('module->flora->client: native object pool stats', { timeout: 10 * 1000 }, t => {
+  var msgId = crypto.randomBytes(5).toString('hex')
+  var msgName = `pool stats test[${msgId}]`
+  var methodName = `pool stats method[${msgId}]`
+  var recvClient = new Agent(okUri + '#poolAgent', agentOptions)
+  recvClient.subscribe(msgName, (msg, type) => {})
+  recvClient.declareMethod(methodName, (msg, reply) => {
+    reply.end(0, [ 'ok' ])
+  })
+  recvClient.start()
+  var postClient = new Agent(okUri, agentOptions)
+  postClient.start()
+  var before
+
+  setTimeout(() => {
+    before = recvClient.getQueueStats()
+    postClient.post(msgName, [ 1 ])
+    postClient.post(msgName, [ 2 ])
+    postClient.call(methodName, [], 'poolAgent').then((resp) => {
+      t.deepEqual(resp.msg, [ 'ok' ])
+    })
+  }, 500)
+
+  setTimeout(() => {
+    var stats = recvClient.getQueueStats()
+    t.equal(stats.slotHits - before.slotHits, 3)
+    t.equal(stats.slotMisses, 0)
+    t.ok(stats.capsPoolHits + stats.capsPoolMisses >= before.capsPoolHits + before.capsPoolMisses + 3)
+    t.ok(stats.replyPoolHits + stats.replyPoolMisses >= before.replyPoolHits + before.replyPoolMisses + 1)
+    recvClient.close()
+    postClient.close()
+    t.end()
+  }, 1500)
+})
+
+test('module->flora->client: agents of worker threads share connection', { timeout: 10 * 1000 }, t => {
+  var workerThreads
+  try {
+    workerThreads = require('worker_threads')
+  } catch (e) {
+    t.skip('worker_threads not supported')
+    t.end()
+    return
+  }
+  var msgId = crypto.randomBytes(5).toString('hex')
+  var msgName = `worker share connection test[${msgId}]`
+  var uri = okUri + '#workerAgent' + msgId
+  var options = Object.assign({ shareConnection: true }, agentOptions)
+  var worker = new workerThreads.Worker(`
+    var wt = require('worker_threads')
+    var flora = require(wt.workerData.module)
+    var agent = new flora.Agent(wt.workerData.uri, wt.workerData.options)
+    agent.subscribe(wt.workerData.msgName, (msg) => {
+      wt.parentPort.postMessage(msg)
+    })
+    agent.start()
+    wt.parentPort.once('message', () => {
+      agent.close()
+      wt.parentPort.close()
+    })
+  `, {
+    eval: true,
+    workerData: { module: require.resolve('..'), uri: uri, msgName: msgName, options: options }
+  })
+  var client = new Agent(uri, options)
+  var received = []
+  client.subscribe(msgName, (msg, type) => {
+    received.push(msg)
+  })
+  client.start()
+  worker.on('message', (msg) => {
+    t.deepEqual(msg, [ 'hello' ], 'msg routed to worker thread')
+    worker.postMessage('close')
+  })
+  worker.on('exit', () => {
+    t.deepEqual(received, [ [ 'hello' ] ], 'msg routed to main thread')
+    client.close()
+    postClient.close()
+    t.end()
+  })
+  var postClient = new Agent(okUri, agentOptions)
+  postClient.start()
+
+  setTimeout(() => {
+    postClient.post(msgName, [ 'hello' ])
+  }, 500)
+})